@@ -0,0 +1,11 @@
+-- Time of the last change to each guild row, maintained by MySQL.
+-- The periodic refresh selects the rows changed since the last one it applied, the index keeps that a range scan.
+-- Rows that exist when this runs get the current time, the first load after startup reads everything anyway.
+
+ALTER TABLE discord_guild
+	ADD COLUMN updated_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP,
+	ADD INDEX discord_guild_updated_at (updated_at);
+
+ALTER TABLE wow_guild
+	ADD COLUMN updated_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP,
+	ADD INDEX wow_guild_updated_at (updated_at);
@@ -1,7 +1,11 @@
 ﻿#include <dpp/cluster.h>
 
+#include <mutex>
+#include <unordered_set>
+
 #include "command_handler.h"
 #include "guildbook_command.h"
+#include "mimiron.h"
 
 using namespace mimiron;
 
@@ -11,8 +15,53 @@ std::string format_user(const dpp::user &user) {
   return "`" + user.username + "` (" + user.id.str() + ")";
 }
 
+std::mutex acknowledged_mutex;
+std::unordered_set<uint64_t> acknowledged;
+
+bool was_acknowledged(const dpp::slashcommand_t &event) {
+  std::scoped_lock lock{acknowledged_mutex};
+
+  return acknowledged.contains(event.command.id);
+}
+
+void forget_acknowledged(const dpp::slashcommand_t &event) {
+  std::scoped_lock lock{acknowledged_mutex};
+
+  acknowledged.erase(event.command.id);
+}
+
+std::string format_api_usage(mimiron &bot) {
+  return "WoW API usage: " + to_string(bot.resource_manager().api_usage());
+}
+
+void reply_busy(const dpp::slashcommand_t &event) {
+  dpp::message busy{"⏳ I'm a bit busy right now, please try again in a "
+                    "moment."};
+
+  // a second reply would be rejected and leave the user on "thinking..."
+  if (was_acknowledged(event)) {
+    event.edit_original_response(busy);
+  } else {
+    event.reply(busy.set_flags(dpp::m_ephemeral));
+  }
+}
+
 } // namespace
 
+namespace mimiron {
+
+dpp::async<dpp::confirmation_callback_t>
+acknowledge(const dpp::slashcommand_t &event, bool ephemeral) {
+  {
+    std::scoped_lock lock{acknowledged_mutex};
+
+    acknowledged.insert(event.command.id);
+  }
+  return event.co_thinking(ephemeral);
+}
+
+} // namespace mimiron
+
 const std::string &
 command_handler::slashcommand_node::get_name() const noexcept {
   return command.name;
@@ -132,17 +181,34 @@ auto command_handler::operator()(const dpp::slashcommand_t &event)
   if (command_fun *fun =
           find_command(command.name, subcommand, subcommandgroup);
       fun) {
+    // answer right away rather than letting the interaction time out
+    if (_bot.overloaded()) {
+      cluster.log(dpp::ll_warning, "refusing command `" +
+                                       std::move(full_command).str() +
+                                       "` sent by " + format_user(issuer) +
+                                       ": overloaded, " +
+                                       format_api_usage(_bot));
+      reply_busy(event);
+      co_return;
+    }
     try {
       if (fun->index() == 0) {
         co_await std::invoke(std::get<0>(*fun), event, bottom_options);
       } else {
         std::invoke(std::get<1>(*fun), event, bottom_options);
       }
+    } catch (const overloaded_exception &e) {
+      cluster.log(dpp::ll_warning,
+                  "command `" + std::move(full_command).str() + "` sent by " +
+                      format_user(issuer) + " was shed: " + e.what() + ", " +
+                      format_api_usage(_bot));
+      reply_busy(event);
     } catch (const std::exception &e) {
       cluster.log(dpp::ll_error,
                   "exception in command `" + std::move(full_command).str() +
                       "` sent by " + format_user(issuer) + ": " + e.what());
     }
+    forget_acknowledged(event);
   } else {
     cluster.log(dpp::ll_error, "user " + format_user(issuer) +
                                    " sent unknown command `" +
@@ -5,6 +5,7 @@
 #include <dpp/dispatcher.h>
 #include <dpp/coro/task.h>
 #include <dpp/coro/coroutine.h>
+#include <dpp/coro/async.h>
 
 #include "command_handler.h"
 
@@ -211,6 +212,12 @@ using command_resolver = std::function<Ret(const dpp::slashcommand_t&, std::span
 
 }
 
+/**
+ * Defer the reply like event.co_thinking(), and remember that the interaction was acknowledged:
+ * a command refused past this point gets its response edited rather than a second reply, which Discord would reject.
+ */
+dpp::async<dpp::confirmation_callback_t> acknowledge(const dpp::slashcommand_t& event, bool ephemeral = false);
+
 class command_handler {
 public:
 	using command_fun = std::variant<detail::command_resolver<dpp::coroutine<>>, detail::command_resolver<void>>;
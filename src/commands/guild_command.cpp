@@ -4,6 +4,30 @@
 
 namespace mimiron {
 
+namespace {
+
+constexpr auto button_lifetime = 10min;
+
+/**
+ * Disable every component of a message, returns whether anything changed.
+ */
+bool disable_components(dpp::message &msg) {
+  bool changed = false;
+  for (dpp::component &row : msg.components) {
+    if (row.disabled == false)
+      changed = true;
+    row.disabled = true;
+    for (dpp::component &button : row.components) {
+      if (button.disabled == false)
+        changed = true;
+      button.disabled = true;
+    }
+  }
+  return changed;
+}
+
+}
+
 guild_command::guild_command(mimiron& bot) :
   _bot(&bot)
 {}
@@ -21,7 +45,7 @@ dpp::coroutine<void> guild_command::_show_empty_menu(const dpp::slashcommand_t &
   dpp::guild_member const* member = event.command.guild_id ? &event.command.member : nullptr;
   dpp::cluster &cluster = *event.from->creator;
 
-  auto thinking = event.co_thinking();
+  auto thinking = acknowledge(event);
 
   dpp::confirmation_callback_t result;
   std::string interaction_id = event.command.id.str();
@@ -40,9 +64,15 @@ dpp::coroutine<void> guild_command::_show_empty_menu(const dpp::slashcommand_t &
     row.set_type(dpp::cot_action_row);
     row.components.push_back(std::move(button));
     throw_if_error(co_await thinking);
-    throw_if_error(co_await event.co_edit_original_response(
+    auto edited = co_await event.co_edit_original_response(
       std::move(m)
-    ));
+    );
+    throw_if_error(edited);
+    _bot->timers().schedule_after(button_lifetime, [&cluster, msg = std::get<dpp::message>(std::move(edited.value))]() mutable {
+      if (disable_components(msg)) {
+        cluster.message_edit(msg);
+      }
+    });
   }
 }
 
@@ -50,21 +80,11 @@ dpp::coroutine<void> guild_command::add_guild(const dpp::button_click_t& event)
   const dpp::message &event_msg = event.command.msg;
   dpp::cluster& cluster = *event.from->creator;
 
-  if (auto time_since = system_clock::now() - discord_time(event_msg.get_creation_time()); time_since > 10min) {
+  /* Buttons are disabled by a timer when they expire, this catches the ones whose timer was lost to a restart */
+  if (auto time_since = system_clock::now() - discord_time(event_msg.get_creation_time()); time_since > button_lifetime) {
     event.reply(dpp::message{"This button has expired!"}.set_flags(dpp::m_ephemeral));
     dpp::message msg = event_msg;
-    bool edit = false;
-    for (dpp::component &row : msg.components) {
-      if (row.disabled == false)
-        edit = true;
-      row.disabled = true;
-      for (dpp::component &button : row.components) {
-        if (button.disabled == false)
-          edit = true;
-        button.disabled = true;
-      }
-    }
-    if (edit) {
+    if (disable_components(msg)) {
       cluster.message_edit(msg);
     }
     co_return;
@@ -77,11 +97,21 @@ dpp::coroutine<void> guild_command::add_guild(const dpp::button_click_t& event)
     co_return;
   }
 
-  auto realms = co_await _bot->resource_manager().get_realms(wow::api_regions::north_america[wow::classic_era]);
-
-  for (const auto& r : realms.value()) {
-    auto realm_res = co_await _bot->resource_manager().get_realm(wow::api_regions::north_america[wow::classic_era], r.slug);
-    const auto& realm = realm_res.value();
+  const auto &location = wow::api_regions::north_america[wow::classic_era];
+  /* Someone is waiting on the wizard, go ahead of background fetches */
+  auto realms = co_await _bot->resource_manager().get_realms(location, priority::interactive, event.command.guild_id);
+  auto slugs = realms.value() | std::views::transform(&wow::realm_entry::slug) | std::ranges::to<std::vector>();
+
+  for (const auto &fetched : co_await _bot->resource_manager().get_many<wow::realm>(location, std::move(slugs), priority::interactive, event.command.guild_id)) {
+    if (auto const *error = std::get_if<std::exception_ptr>(&fetched); error) {
+      try {
+        std::rethrow_exception(*error);
+      } catch (const std::exception &e) {
+        cluster.log(dpp::ll_warning, std::format("could not fetch realm: {}", e.what()));
+      }
+      continue;
+    }
+    const auto &realm = std::get<0>(fetched).value();
     cluster.log(dpp::ll_info, std::format("{} - {} - {} {} - {}", realm.name[wow::locale::en_us], realm.category[wow::locale::en_us], realm.type.name[wow::locale::en_us], realm.type.name[wow::locale::en_us], realm.timezone));
   }
 
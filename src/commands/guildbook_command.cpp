@@ -7,6 +7,7 @@
 #include <dpp/restresults.h>
 #include <dpp/utility.h>
 
+#include "mimiron.h"
 #include "wow/guildbook/guildbook_data.h"
 
 using namespace mimiron;
@@ -60,7 +61,7 @@ guildbook_command::upload::operator()(const dpp::slashcommand_t &event,
   }
   dpp::cluster *cluster = event.from->creator;
 
-  auto thinking = event.co_thinking(false);
+  auto thinking = acknowledge(event);
   auto result = co_await cluster->co_request(it->second.url, dpp::m_get);
   if (!(result.status >= 200 && result.status < 300)) {
     cluster->log(
@@ -74,6 +75,8 @@ guildbook_command::upload::operator()(const dpp::slashcommand_t &event,
         {"❌ There was an error in downloading the file."});
     co_return;
   }
+  // Parsing and saving block, the rest of the command runs on the pool
+  co_await bot.workers().schedule_on();
   bool success = false;
   wow::guildbook_data data;
   try {
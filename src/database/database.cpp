@@ -1,8 +1,34 @@
 #include "database.h"
 #include "query.h"
 
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <utility>
+
 namespace mimiron::sql {
 
+namespace {
+
+bool iequals(std::string_view lhs, std::string_view rhs) noexcept {
+  return std::ranges::equal(lhs, rhs, [](char a, char b) {
+    return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+  });
+}
+
+bool icontains(std::string_view haystack, std::string_view needle) noexcept {
+  return !std::ranges::search(haystack, needle, [](char a, char b) {
+    return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+  }).empty();
+}
+
+int64_t steady_now() noexcept {
+  return app_clock::now().time_since_epoch().count();
+}
+
+} // namespace
+
 database_exception::database_exception(std::string msg)
     : message{std::move(msg)} {}
 
@@ -10,25 +36,244 @@ const char *database_exception::what() const noexcept {
   return message.c_str();
 }
 
+mysql_database::statement_lease::~statement_lease() { _give_back(); }
+
+auto mysql_database::statement_lease::operator=(statement_lease &&other) noexcept
+    -> statement_lease & {
+  if (this != &other) {
+    _give_back();
+    _server = std::exchange(other._server, nullptr);
+    _node = std::move(other._node);
+  }
+  return *this;
+}
+
+void mysql_database::statement_lease::discard() noexcept {
+  _node = {};
+  _server = nullptr;
+}
+
+void mysql_database::statement_lease::_give_back() noexcept {
+  if (!_node) {
+    return;
+  }
+  /* Prepared on a replica connection that has since been replaced */
+  if (_node.mapped().get()->mysql == nullptr) {
+    _node = {};
+    return;
+  }
+  /* The stored result isn't needed anymore, the bind buffers are kept for the next execution */
+  mysql_stmt_free_result(_node.mapped().get());
+
+  std::scoped_lock lock{_server->statements_mutex};
+
+  _server->statements.insert(std::move(_node));
+}
+
+mysql_database::endpoint::endpoint(const connection_info &info)
+    : info{info}, connection{mysql_init(nullptr)} {}
+
+bool mysql_database::endpoint::connect() {
+  /* Options only apply to the connections made after them */
+  mysql_options(connection.get(), MYSQL_READ_DEFAULT_GROUP, "mimiron");
+  MYSQL *mysql = mysql_real_connect(
+      connection.get(), info.host.empty() ? nullptr : info.host.c_str(),
+      info.username.empty() ? nullptr : info.username.c_str(),
+      info.password.empty() ? nullptr : info.password.c_str(),
+      info.database.empty() ? nullptr : info.database.c_str(), info.port,
+      nullptr, 0);
+  if (!mysql) {
+    return false;
+  }
+  connected = true;
+  return true;
+}
+
 mysql_database::mysql_database(const connection_info &info)
-    : db_info{info}, connection{mysql_init(nullptr)} {
-  if (MYSQL *mysql = connect(); !mysql) {
-    throw database_exception{mysql_error(connection.get())};
-  } else {
-    mysql_options(mysql, MYSQL_READ_DEFAULT_GROUP, "mimiron");
+    : mysql_database(topology{.primary = info}) {}
+
+mysql_database::mysql_database(const topology &servers)
+    : _primary{servers.primary}, _max_replica_lag{servers.max_replica_lag},
+      _read_your_writes{servers.read_your_writes},
+      _probe_interval{servers.probe_interval} {
+  if (!_primary.connect()) {
+    throw database_exception{mysql_error(_primary.connection.get())};
+  }
+  _primary.executor.set_capacity(servers.queue_capacity);
+  _replicas.reserve(servers.replicas.size());
+  for (const connection_info &replica : servers.replicas) {
+    endpoint &added = *_replicas.emplace_back(std::make_unique<endpoint>(replica));
+
+    added.executor.set_capacity(servers.queue_capacity);
+    _probe(added);
   }
 }
 
-mysql_database::mysql_database(const connection_info &info, std::nullopt_t)
-    : db_info{info}, connection{mysql_init(nullptr)} {}
+bool mysql_database::is_read_only(std::string_view sql) noexcept {
+  auto begin = std::ranges::find_if_not(sql, [](char c) {
+    return std::isspace(static_cast<unsigned char>(c)) || c == '(';
+  });
+  auto end = std::find_if_not(begin, sql.end(), [](char c) {
+    return std::isalpha(static_cast<unsigned char>(c));
+  });
+  std::string_view keyword{begin, end};
 
-MYSQL *mysql_database::connect() {
-  return mysql_real_connect(
-      connection.get(), db_info.host.empty() ? nullptr : db_info.host.c_str(),
-      db_info.username.empty() ? nullptr : db_info.username.c_str(),
-      db_info.password.empty() ? nullptr : db_info.password.c_str(),
-      db_info.database.empty() ? nullptr : db_info.database.c_str(),
-      db_info.port, nullptr, 0);
+  if (!iequals(keyword, "SELECT") && !iequals(keyword, "SHOW")) {
+    return false;
+  }
+  /* Locking reads have to see, and lock, the rows on the primary */
+  return !icontains(sql, "FOR UPDATE") && !icontains(sql, "FOR SHARE") && !icontains(sql, "LOCK IN SHARE MODE");
+}
+
+auto mysql_database::_lease(endpoint &server, std::string_view sql)
+    -> statement_lease {
+  {
+    std::scoped_lock lock{server.statements_mutex};
+
+    if (auto it = server.statements.find(sql); it != server.statements.end()) {
+      return {server, server.statements.extract(it)};
+    }
+  }
+  /* The node is allocated once here, then moves between the lease and the cache */
+  statement_cache prepared;
+
+  prepared.emplace(std::string{sql}, _prepare_sync(server, sql));
+  return {server, prepared.extract(prepared.begin())};
+}
+
+void mysql_database::_execute(MYSQL_STMT *stmt, session for_session) {
+  if (mysql_stmt_execute(stmt) != 0) {
+    throw database_exception{mysql_stmt_error(stmt)};
+  }
+  if (mysql_stmt_field_count(stmt) != 0) {
+    return;
+  }
+  auto now = steady_now();
+
+  if (for_session.id == 0) {
+    _last_write.store(now, std::memory_order_relaxed);
+    return;
+  }
+  std::unique_lock lock{_session_writes_mutex};
+
+  _session_writes[for_session.id] = now;
+  if (_session_writes.size() >= _sweep_session_writes_at) {
+    std::erase_if(_session_writes, [&](const auto &entry) {
+      return app_duration{now - entry.second} >= _read_your_writes;
+    });
+    _sweep_session_writes_at = std::max<size_t>(64, _session_writes.size() * 2);
+  }
+}
+
+bool mysql_database::_wrote_recently(session for_session, int64_t now) {
+  if (app_duration{now - _last_write.load(std::memory_order_relaxed)} < _read_your_writes) {
+    return true;
+  }
+  if (for_session.id == 0) {
+    return false;
+  }
+  std::shared_lock lock{_session_writes_mutex};
+  auto it = _session_writes.find(for_session.id);
+
+  return it != _session_writes.end() && app_duration{now - it->second} < _read_your_writes;
+}
+
+auto mysql_database::_pick_replica(session for_session) -> endpoint & {
+  if (_replicas.empty()) {
+    return _primary;
+  }
+  auto now = steady_now();
+  if (_wrote_recently(for_session, now)) {
+    return _primary;
+  }
+
+  /* Start from a different replica every time so that equally lagging ones share the load */
+  size_t first = _next_replica.fetch_add(1, std::memory_order_relaxed);
+  endpoint *best = nullptr;
+  int64_t best_lag = unavailable;
+
+  for (size_t i = 0; i < _replicas.size(); ++i) {
+    endpoint &replica = *_replicas[(first + i) % _replicas.size()];
+
+    if (app_duration{now - replica.probed_at.load(std::memory_order_relaxed)} >= _probe_interval) {
+      _probe(replica);
+    }
+    int64_t lag = replica.lag.load(std::memory_order_relaxed);
+    if (lag <= _max_replica_lag.count() && lag < best_lag && !replica.executor.overloaded()) {
+      best = &replica;
+      best_lag = lag;
+    }
+  }
+  return best ? *best : _primary;
+}
+
+auto mysql_database::_endpoint_of(MYSQL_STMT *stmt) noexcept -> endpoint & {
+  for (const auto &replica : _replicas) {
+    if (replica->connection.get() == stmt->mysql) {
+      return *replica;
+    }
+  }
+  return _primary;
+}
+
+void mysql_database::_probe(endpoint &replica) {
+  if (replica.probing.exchange(true)) {
+    return;
+  }
+  /* Runs on the replica's own thread, which is the only one allowed to use its connection */
+  replica.executor.queue([&replica]() noexcept {
+    replica.lag = _measure_lag(replica);
+    replica.probed_at = steady_now();
+    replica.probing = false;
+  });
+}
+
+int64_t mysql_database::_measure_lag(endpoint &replica) noexcept {
+  if (!replica.connected) {
+    /* A handle whose connection failed can't be reused, nor can the statements prepared on it */
+    {
+      std::scoped_lock lock{replica.statements_mutex};
+
+      replica.statements.clear();
+    }
+    replica.connection.reset(mysql_init(nullptr));
+    if (!replica.connect()) {
+      return unavailable;
+    }
+  }
+
+  MYSQL *mysql = replica.connection.get();
+  if (mysql_query(mysql, "SHOW REPLICA STATUS") != 0 && mysql_query(mysql, "SHOW SLAVE STATUS") != 0) {
+    replica.connected = mysql_ping(mysql) == 0;
+    return unavailable;
+  }
+
+  managed_ptr<MYSQL_RES, &mysql_free_result> result{mysql_store_result(mysql)};
+  if (!result) {
+    return unavailable;
+  }
+  MYSQL_ROW row = mysql_fetch_row(result.get());
+  if (!row) {
+    /* Not replicating from anything */
+    return unavailable;
+  }
+
+  MYSQL_FIELD const *fields = mysql_fetch_fields(result.get());
+  for (unsigned int i = 0; i < mysql_num_fields(result.get()); ++i) {
+    std::string_view name{fields[i].name, fields[i].name_length};
+
+    if (name != "Seconds_Behind_Source" && name != "Seconds_Behind_Master") {
+      continue;
+    }
+    /* NULL when the replication threads are stopped */
+    if (!row[i]) {
+      return unavailable;
+    }
+    int64_t lag = unavailable;
+    std::from_chars(row[i], row[i] + std::strlen(row[i]), lag);
+    return lag;
+  }
+  return unavailable;
 }
 
 } // namespace mimiron::sql
@@ -1,14 +1,19 @@
 #ifndef MIMIRON_DATABASE_H_
 #define MIMIRON_DATABASE_H_
 
+#include <atomic>
 #include <cassert>
 #include <expected>
 #include <functional>
 #include <memory>
 #include <type_traits>
 #include <string>
+#include <string_view>
 #include <optional>
+#include <mutex>
 #include <shared_mutex>
+#include <unordered_map>
+#include <vector>
 
 #include <dpp/coro/task.h>
 #include <dpp/coro/async.h>
@@ -16,6 +21,7 @@
 
 #include "query.h"
 
+#include "../common.h"
 #include "tools/worker.h"
 #include "tools/tools.h"
 
@@ -66,6 +72,8 @@ inline constexpr auto mysql_type_in = empty{};
 template <> inline constexpr auto mysql_type_in<signed char> = MYSQL_TYPE_TINY;
 template <> inline constexpr auto mysql_type_in<char> = MYSQL_TYPE_TINY;
 template <> inline constexpr auto mysql_type_in<int> = MYSQL_TYPE_LONG;
+/* int64_t is a long on LP64 platforms */
+template <> inline constexpr auto mysql_type_in<long> = sizeof(long) == 8 ? MYSQL_TYPE_LONGLONG : MYSQL_TYPE_LONG;
 template <> inline constexpr auto mysql_type_in<long long> = MYSQL_TYPE_LONGLONG;
 template <> inline constexpr auto mysql_type_in<float> = MYSQL_TYPE_FLOAT;
 template <> inline constexpr auto mysql_type_in<double> = MYSQL_TYPE_DOUBLE;
@@ -80,6 +88,7 @@ template <> inline constexpr auto mysql_type_out<signed char> = MYSQL_TYPE_TINY;
 template <> inline constexpr auto mysql_type_out<char> = MYSQL_TYPE_TINY;
 template <> inline constexpr auto mysql_type_out<short> = MYSQL_TYPE_SHORT;
 template <> inline constexpr auto mysql_type_out<int> = MYSQL_TYPE_LONG;
+template <> inline constexpr auto mysql_type_out<long> = sizeof(long) == 8 ? MYSQL_TYPE_LONGLONG : MYSQL_TYPE_LONG;
 template <> inline constexpr auto mysql_type_out<long long> = MYSQL_TYPE_LONGLONG;
 template <> inline constexpr auto mysql_type_out<float> = MYSQL_TYPE_FLOAT;
 template <> inline constexpr auto mysql_type_out<double> = MYSQL_TYPE_DOUBLE;
@@ -87,6 +96,12 @@ template <> inline constexpr auto mysql_type_out<char*> = MYSQL_TYPE_BLOB;
 template <> inline constexpr auto mysql_type_out<std::byte*> = MYSQL_TYPE_BLOB;
 template <size_t N> inline constexpr auto mysql_type_out<char[N]> = MYSQL_TYPE_STRING;
 
+/**
+ * Columns that are stored into a resizable container, their size is only known once the row is fetched.
+ */
+template <typename T>
+inline constexpr bool is_variable_length = std::ranges::contiguous_range<T> && requires (T t, size_t n) { t.resize(n); };
+
 template <typename T>
 struct mysql_binder_helper;
 
@@ -146,7 +161,7 @@ struct mysql_binder_helper<T> {
 	}
 
 	void bind_out(MYSQL_BIND &bind, T& arg) const noexcept {
-		if constexpr (requires (T t, size_t n) { t.resize(n); }) {
+		if constexpr (is_variable_length<T>) {
 			bind.buffer = nullptr;
 			bind.buffer_length = 0;
 			bind.length = &bind.length_value;
@@ -222,33 +237,62 @@ constexpr void stmt_bind_in(MYSQL_BIND *binds, std::tuple<const Args&...> argt,
 	(impl(binds[Ns], std::get<Ns>(argt)), ...);
 }
 
+/**
+ * Output buffers of optional fields live inside the optional, re-engage the ones a NULL in the previous row reset so the next fetch writes into a live object.
+ */
 template <typename... Args, size_t... Ns>
-constexpr void stmt_fetch_texts(MYSQL_STMT* stmt, std::tuple<Args...> &argt, MYSQL_BIND (&binds)[sizeof...(Args)], std::index_sequence<Ns...>) {
+constexpr void stmt_engage_optionals(std::tuple<Args...> &argt, std::index_sequence<Ns...>) {
 	auto impl = [&]<size_t N>() constexpr {
 		using arg = std::remove_cvref_t<std::tuple_element_t<N, std::tuple<Args...>>>;
+		if constexpr (is_optional<arg>) {
+			if (!std::get<N>(argt).has_value()) {
+				std::get<N>(argt).emplace();
+			}
+		}
+	};
+	(impl.template operator()<Ns>(), ...);
+}
+
+/**
+ * Store the variable-length columns of the row that was just fetched into their fields.
+ *
+ * Columns whose value fit in their bound buffer are copied from it, truncated ones are fetched again straight into the field.
+ */
+template <typename... Args, size_t... Ns>
+void stmt_fetch_texts(MYSQL_STMT* stmt, std::tuple<Args...> &argt, MYSQL_BIND* binds, std::index_sequence<Ns...>) {
+	auto impl = [&]<size_t N>() {
+		using arg = std::remove_cvref_t<std::tuple_element_t<N, std::tuple<Args...>>>;
+		using column = remove_optional_t<arg>;
+		MYSQL_BIND& bind = binds[N];
+
 		if constexpr(!is_optional<arg>) {
-			assert("non-optional field cannot be null" && !binds[N].is_null_value);
+			assert("non-optional field cannot be null" && !bind.is_null_value);
 		} else {
-			if (binds[N].is_null_value) {
+			if (bind.is_null_value) {
 				std::get<N>(argt) = std::nullopt;
 				return;
 			}
 		}
-		if constexpr(std::ranges::contiguous_range<arg>) {
-			MYSQL_BIND& bind = binds[N];
-			if (*bind.error) {
-				arg* field;
-				if constexpr (is_optional<arg>) {
-					field = &(*std::get<N>(argt));
-				} else {
-					field = &std::get<N>(argt);
-				}
-				field->resize(bind.length_value);
-				bind.buffer = static_cast<void*>(field->data());
-				bind.buffer_length = bind.length_value;
-				if (auto result = mysql_stmt_fetch_column(stmt, &bind, N, 0); result != 0) {
+		if constexpr(is_variable_length<column>) {
+			column* field;
+			if constexpr (is_optional<arg>) {
+				field = &(*std::get<N>(argt));
+			} else {
+				field = &std::get<N>(argt);
+			}
+			if (bind.error_value) {
+				MYSQL_BIND whole_column = bind;
+
+				field->resize(bind.length_value / sizeof(std::ranges::range_value_t<column>));
+				whole_column.buffer = static_cast<void*>(field->data());
+				whole_column.buffer_length = bind.length_value;
+				if (auto result = mysql_stmt_fetch_column(stmt, &whole_column, N, 0); result != 0) {
 					throw database_exception{mysql_stmt_error(stmt)};
 				}
+			} else {
+				auto const* data = static_cast<std::ranges::range_value_t<column> const*>(bind.buffer);
+
+				field->assign(data, data + bind.length_value / sizeof(std::ranges::range_value_t<column>));
 			}
 		}
 	};
@@ -261,24 +305,24 @@ struct mysql_fetchable_statement {
 	bool fetch(std::tuple<Args...>& values) {
 		MYSQL_BIND binds[sizeof...(Args)];
 
-		memset(&binds, 0, sizeof(MYSQL_BIND) * sizeof...(Args));
-		stmt_bind_out(binds, values, std::make_index_sequence<sizeof...(Args)>{});
-		if (auto result = mysql_stmt_bind_result(static_cast<Derived*>(this)->get(), binds); result != 0) {
-			throw database_exception{mysql_stmt_error(static_cast<Derived*>(this)->get())};
-		}
+		_bind_out(binds, values);
 		return _fetch(binds, values);
 	}
 
 	template <typename T>
 	requires (std::is_aggregate_v<T>)
 	bool fetch(T& t) {
-		return fetch(boost::pfr::structure_tie(t));
+		auto as_references = boost::pfr::structure_tie(t);
+
+		return fetch(as_references);
 	}
 
 	template <typename T>
 	requires (std::is_scalar_v<T>)
 	bool fetch(T& t) {
-		return fetch(std::tuple<T&>(t));
+		auto as_references = std::tuple<T&>(t);
+
+		return fetch(as_references);
 	}
 
 	template <typename T>
@@ -295,45 +339,113 @@ struct mysql_fetchable_statement {
 	requires (std::is_aggregate_v<T>)
 	std::vector<T> fetch_all() {
 		MYSQL_BIND binds[boost::pfr::tuple_size_v<T>];
-
-		memset(&binds, 0, sizeof(MYSQL_BIND) * boost::pfr::tuple_size_v<T>);
-		std::vector<T> ret;
 		T value;
 		auto as_references = boost::pfr::structure_tie(value);
 
-		stmt_bind_out(binds, as_references, std::make_index_sequence<boost::pfr::tuple_size_v<T>>{});
-		if (auto result = mysql_stmt_bind_result(static_cast<Derived*>(this)->get(), binds); result != 0) {
-			throw database_exception{mysql_stmt_error(static_cast<Derived*>(this)->get())};
+		_bind_out(binds, as_references);
+		return _fetch_all(binds, as_references, value);
+	}
+
+protected:
+	template <typename... Args>
+	void _bind_out(MYSQL_BIND* binds, std::tuple<Args...>& values) {
+		std::memset(binds, 0, sizeof(MYSQL_BIND) * sizeof...(Args));
+		stmt_bind_out(binds, values, std::make_index_sequence<sizeof...(Args)>{});
+		if (auto result = mysql_stmt_bind_result(_stmt(), binds); result != 0) {
+			throw database_exception{mysql_stmt_error(_stmt())};
 		}
-		if (auto result = mysql_stmt_store_result(static_cast<Derived*>(this)->get()); result != 0) {
-			throw database_exception{mysql_stmt_error(static_cast<Derived*>(this)->get())};
+	}
+
+	/**
+	 * Store the whole result, then give every variable-length column a buffer sized after the longest value in the result,
+	 * so that each row is decoded in a single fetch.
+	 */
+	template <typename T, typename... Args>
+	std::vector<T> _fetch_all(MYSQL_BIND* binds, std::tuple<Args...>& row_references, T& row) {
+		std::vector<T> ret;
+		bool update_max_length = true;
+
+		if (auto result = mysql_stmt_attr_set(_stmt(), STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_length); result != 0) {
+			throw database_exception{mysql_stmt_error(_stmt())};
 		}
-		while (true) {
-			if (!_fetch(binds, as_references)) {
-				break;
-			}
-			ret.push_back(std::move(value));
+		if (auto result = mysql_stmt_store_result(_stmt()); result != 0) {
+			throw database_exception{mysql_stmt_error(_stmt())};
+		}
+		_bind_column_buffers<Args...>(binds);
+		ret.reserve(mysql_stmt_num_rows(_stmt()));
+		while (_fetch(binds, row_references)) {
+			ret.push_back(std::move(row));
 		}
 		return ret;
 	}
 
-private:
 	template <typename... Args>
-	bool _fetch(MYSQL_BIND (&binds)[sizeof...(Args)], std::tuple<Args...>& values) {
-		int status = mysql_stmt_fetch(static_cast<Derived*>(this)->get());
+	bool _fetch(MYSQL_BIND* binds, std::tuple<Args...>& values) {
+		stmt_engage_optionals(values, std::make_index_sequence<sizeof...(Args)>{});
+		int status = mysql_stmt_fetch(_stmt());
 		if (status == MYSQL_NO_DATA) {
 			return false;
 		}
-		if (status == MYSQL_DATA_TRUNCATED) {
-			stmt_fetch_texts(static_cast<Derived*>(this)->get(), values, binds, std::make_index_sequence<sizeof...(Args)>{});
-		}
-		else if (status != 0) {
-			throw database_exception{mysql_stmt_error(static_cast<Derived*>(this)->get())};
+		if (status != 0 && status != MYSQL_DATA_TRUNCATED) {
+			throw database_exception{mysql_stmt_error(_stmt())};
 		}
+		stmt_fetch_texts(_stmt(), values, binds, std::make_index_sequence<sizeof...(Args)>{});
 		return true;
 	}
+
+private:
+	MYSQL_STMT* _stmt() noexcept {
+		return static_cast<Derived*>(this)->get();
+	}
+
+	template <typename... Args>
+	void _bind_column_buffers(MYSQL_BIND* binds) {
+		constexpr auto variable_length = std::array{is_variable_length<remove_optional_t<std::remove_cvref_t<Args>>>...};
+
+		if constexpr (std::ranges::none_of(variable_length, std::identity{})) {
+			return;
+		} else {
+			managed_ptr<MYSQL_RES, &mysql_free_result> metadata{mysql_stmt_result_metadata(_stmt())};
+
+			if (!metadata) {
+				throw database_exception{mysql_stmt_error(_stmt())};
+			}
+
+			MYSQL_FIELD const* fields = mysql_fetch_fields(metadata.get());
+			size_t total_length = 0;
+
+			for (size_t i = 0; i < variable_length.size(); ++i) {
+				if (variable_length[i]) {
+					total_length += fields[i].max_length;
+				}
+			}
+			_column_buffer.resize(total_length);
+
+			char* buffer = _column_buffer.data();
+			for (size_t i = 0; i < variable_length.size(); ++i) {
+				if (variable_length[i]) {
+					binds[i].buffer = buffer;
+					binds[i].buffer_length = fields[i].max_length;
+					buffer += fields[i].max_length;
+				}
+			}
+			if (auto result = mysql_stmt_bind_result(_stmt(), binds); result != 0) {
+				throw database_exception{mysql_stmt_error(_stmt())};
+			}
+		}
+	}
+
+	/* Backing storage of the variable-length columns of a stored result, kept between executions */
+	std::vector<char> _column_buffer;
 };
 
+/**
+ * Statement whose result type is known at compile time.
+ *
+ * Input and output bindings are stored in the statement itself so that executing it again does not allocate:
+ * with a known number of placeholders they are fixed arrays, otherwise the vector keeps its capacity between binds.
+ * Results are fetched into a row owned by the statement, which is bound once and only re-bound if the statement was moved.
+ */
 template <typename DataType, size_t Placeholders>
 class mysql_prepared_statement<query_select, DataType, Placeholders> : public managed_ptr<MYSQL_STMT, &mysql_stmt_close>, private mysql_fetchable_statement<mysql_prepared_statement<query_select, DataType, Placeholders>> {
 	friend class mysql_fetchable_statement<mysql_prepared_statement>;
@@ -353,28 +465,41 @@ public:
 	requires (Placeholders == std::numeric_limits<size_t>::max() || Placeholders == sizeof...(Args))
 	void bind(const Args&... args) {
 		constexpr auto num = sizeof...(Args);
-		if constexpr (Placeholders != std::numeric_limits<size_t>::max()) {
-			_placeholders_in.data = std::vector<MYSQL_BIND>(num);
+		if constexpr (Placeholders == std::numeric_limits<size_t>::max()) {
+			_binds_in().assign(num, MYSQL_BIND{});
 		} else {
-			std::memset(_placeholders_in.data.data(), 0, sizeof(MYSQL_BIND) * num);
+			std::memset(_binds_in().data(), 0, sizeof(MYSQL_BIND) * num);
 		}
-		stmt_bind_in(_placeholders_in.data.data(), std::forward_as_tuple(args...), std::make_index_sequence<sizeof...(Args)>{});
+		stmt_bind_in(_binds_in().data(), std::forward_as_tuple(args...), std::make_index_sequence<sizeof...(Args)>{});
 
-		if (mysql_stmt_bind_param(get(), _binds_in.data()) != 0) {
+		if (mysql_stmt_bind_param(get(), _binds_in().data()) != 0) {
 			throw database_exception{mysql_stmt_error(get())};
 		}
 	}
 
 	bool fetch(DataType& data) {
-		return mysql_fetchable_statement<mysql_prepared_statement>::template fetch<DataType>(data);
+		auto as_references = _bind_row();
+
+		if (!this->_fetch(_binds_out().data(), as_references)) {
+			return false;
+		}
+		data = std::move(_row);
+		return true;
 	}
 
 	std::optional<DataType> fetch() {
-		return mysql_fetchable_statement<mysql_prepared_statement>::template fetch<DataType>();
+		std::optional<DataType> ret{std::in_place};
+
+		if (!fetch(*ret)) {
+			return std::nullopt;
+		}
+		return ret;
 	}
 
 	std::vector<DataType> fetch_all() {
-		return mysql_fetchable_statement<mysql_prepared_statement>::template fetch_all<DataType>();
+		auto as_references = _bind_row();
+
+		return this->_fetch_all(_binds_out().data(), as_references, _row);
 	}
 
 private:
@@ -382,7 +507,24 @@ private:
 		return _placeholders_in.data;
 	}
 
+	auto& _binds_out() noexcept {
+		return _placeholders_out.data;
+	}
+
+	auto _bind_row() {
+		auto as_references = boost::pfr::structure_tie(_row);
+
+		if (_bound_row != &_row) {
+			this->_bind_out(_binds_out().data(), as_references);
+			_bound_row = &_row;
+		}
+		return as_references;
+	}
+
 	mysql_placeholders<Placeholders> _placeholders_in;
+	mysql_placeholders<boost::pfr::tuple_size_v<DataType>> _placeholders_out;
+	DataType _row{};
+	DataType const* _bound_row = nullptr;
 };
 
 template <>
@@ -401,8 +543,8 @@ public:
 	template <typename... Args>
 	void bind(const Args&... args) {
 		constexpr auto num = sizeof...(Args);
-		_placeholders_in.data = std::vector<MYSQL_BIND>(num);
-		stmt_bind_in(_placeholders_in.data.data(), std::forward_as_tuple(args...), std::make_index_sequence<sizeof...(Args)>{});
+		_binds_in().assign(num, MYSQL_BIND{});
+		stmt_bind_in(_binds_in().data(), std::forward_as_tuple(args...), std::make_index_sequence<sizeof...(Args)>{});
 
 		if (mysql_stmt_bind_param(get(), _binds_in().data()) != 0) {
 			throw database_exception{mysql_stmt_error(get())};
@@ -445,104 +587,196 @@ public:
 		uint16_t port = 3306;
 	};
 
-	mysql_database(const connection_info& info = {});
+	/**
+	 * Servers to connect to. Reads go to the replica that is the least behind the primary, as long as it is within `max_replica_lag`,
+	 * and to the primary otherwise. Writes always go to the primary, and so do reads made less than `read_your_writes` after a write
+	 * of the same session.
+	 */
+	struct topology {
+		connection_info primary;
+		std::vector<connection_info> replicas = {};
+		seconds max_replica_lag = 5s;
+		seconds read_your_writes = 5s;
+		seconds probe_interval = 2s;
+		/* Queries waiting on one server past which new ones are refused with overloaded_exception, 0 for no limit */
+		size_t queue_capacity = 0;
+	};
 
-	template <typename Type, typename Table, typename Where, typename Order>
-	auto prepare_sync(const sql::query<Type, Table, Where, Order>& q) {
-		using query_helper = query_type_helper<sql::query<Type, Table, Where, Order>>;
-		static_assert(query_helper::value != query_error, "unrecognized query");
+private:
+	struct endpoint;
 
-		auto stmt = managed_ptr<MYSQL_STMT, &mysql_stmt_close>{mysql_stmt_init(this->connection.get())};
-		auto str = q.to_string();
-		if (mysql_stmt_prepare(stmt.get(), str.data(), str.size()) != 0) {
-			throw database_exception{mysql_error(this->connection.get())};
+	struct string_hash {
+		using is_transparent = void;
+
+		size_t operator()(std::string_view str) const noexcept {
+			return std::hash<std::string_view>{}(str);
 		}
-		return mysql_prepared_statement<query_helper::value, typename query_helper::data_type>{std::move(stmt)};
+	};
+
+	/* Statements that aren't in use by query text, a multimap since the same query can run more than once at a time */
+	using statement_cache = std::unordered_multimap<std::string, mysql_prepared_statement<query_dynamic>, string_hash, std::equal_to<>>;
+
+public:
+	/**
+	 * Statement taken out of its connection's cache by query() and execute(), put back when destroyed
+	 * so that the next query with the same text skips the prepare and reuses the buffers of this one.
+	 */
+	class statement_lease {
+	public:
+		statement_lease() = default;
+		statement_lease(statement_lease&& other) noexcept = default;
+		~statement_lease();
+
+		statement_lease& operator=(statement_lease&& other) noexcept;
+
+		mysql_prepared_statement<query_dynamic>& operator*() const noexcept {
+			return _node.mapped();
+		}
+
+		mysql_prepared_statement<query_dynamic>* operator->() const noexcept {
+			return &_node.mapped();
+		}
+
+		/**
+		 * Close the statement instead of putting it back, for one left in an unknown state by an error.
+		 */
+		void discard() noexcept;
+
+	private:
+		friend class mysql_database;
+
+		statement_lease(endpoint& server, statement_cache::node_type node) noexcept : _server{&server}, _node{std::move(node)} {}
+
+		void _give_back() noexcept;
+
+		endpoint* _server = nullptr;
+		statement_cache::node_type _node;
+	};
+
+	/**
+	 * Who queries are made for, typically a Discord guild, so that only that session's reads are sent to the primary after it writes.
+	 * Writes made without a session, id 0, send every read to the primary for a while.
+	 */
+	struct session {
+		uint64_t id;
+	};
+
+	mysql_database(const connection_info& info = {});
+	mysql_database(const topology& servers);
+
+	/**
+	 * Whether a query only reads data and can be sent to a replica.
+	 */
+	static bool is_read_only(std::string_view sql) noexcept;
+
+	/**
+	 * Whether the primary has a full queue. Overloaded replicas are simply not picked for reads.
+	 */
+	bool overloaded() const noexcept {
+		return _primary.executor.overloaded();
 	}
 
-	template <typename Type, typename Table, typename Where, typename Order>
+	/**
+	 * How far behind the primary a replica can be and still serve reads.
+	 */
+	seconds max_replica_lag() const noexcept {
+		return _max_replica_lag;
+	}
+
+	/**
+	 * Prepare a query. When Placeholders is given, the statement binds its parameters into a fixed array
+	 * and the number of placeholders in the query is checked against it.
+	 *
+	 * Synchronous calls run on the calling thread and always use the primary.
+	 */
+	template <size_t Placeholders = std::numeric_limits<size_t>::max(), typename Type, typename Table, typename Where, typename Order>
+	auto prepare_sync(const sql::query<Type, Table, Where, Order>& q) {
+		return _prepare_sync<Placeholders>(_primary, q);
+	}
+
+	template <size_t Placeholders = std::numeric_limits<size_t>::max(), typename Type, typename Table, typename Where, typename Order>
 	auto prepare(const sql::query<Type, Table, Where, Order>& q) {
-		return this->_worker.schedule([this, q]() {
-			return this->prepare_sync(q);
+		endpoint& server = _route(q);
+
+		return server.executor.schedule([this, &server, q]() {
+			return this->_prepare_sync<Placeholders>(server, q);
 		});
 	}
 
 	auto prepare_sync(std::string_view sql) -> mysql_prepared_statement<query_dynamic> {
-		auto stmt = managed_ptr<MYSQL_STMT, &mysql_stmt_close>{mysql_stmt_init(this->connection.get())};
-		if (mysql_stmt_prepare(stmt.get(), sql.data(), sql.size()) != 0) {
-			throw database_exception{mysql_error(this->connection.get())};
-		}
-		return mysql_prepared_statement<query_dynamic>{std::move(stmt)};
+		return _prepare_sync(_primary, sql);
 	}
 
 	auto prepare(std::string sql) -> dpp::awaitable<mysql_prepared_statement<query_dynamic>> {
-		return this->_worker.schedule([this, s = std::move(sql)] {
-			return prepare_sync(s);
+		endpoint& server = _route(sql);
+
+		return server.executor.schedule([this, &server, s = std::move(sql)] {
+			return _prepare_sync(server, s);
 		});
 	}
 
 	template <query_type QueryType, typename DataType, size_t Placeholders, typename... Args>
 	auto query_sync(mysql_prepared_statement<QueryType, DataType, Placeholders>& statement, const Args&... args) -> decltype(statement) {
 		if constexpr (sizeof...(Args) > 0) {
-			statement.bind(std::forward<Args>(args));
-		}
-		if (mysql_stmt_execute(statement.get()) != 0) {
-			throw database_exception{mysql_stmt_error(statement.get())};
+			statement.bind(args...);
 		}
+		_execute(statement.get());
 		return statement;
 	}
 
 	template <query_type QueryType, typename DataType, size_t Placeholders, typename... Args>
 	auto query(mysql_prepared_statement<QueryType, DataType, Placeholders>& statement, Args&&... args) {
-		return this->_worker.schedule([argt = std::forward_as_tuple(this, statement, std::forward<Args>(args)...)] {
+		return _endpoint_of(statement.get()).executor.schedule([argt = std::forward_as_tuple(this, statement, std::forward<Args>(args)...)] {
 			return std::apply(&mysql_database::query_sync<QueryType, DataType, Placeholders, std::remove_cvref_t<Args>...>, argt);
 		});
 	}
 
 	template <typename Type, typename Table, typename Where, typename Order, typename... Args>
 	auto query_sync(const sql::query<Type, Table, Where, Order>& q, const Args&... args_in) {
-		auto statement = prepare_sync(q);
-		if constexpr (sizeof...(Args) > 0) {
-			statement.bind(args_in...);
-		}
-		if (mysql_stmt_execute(statement.get()) != 0) {
-			throw database_exception{mysql_stmt_error(statement.get())};
-		}
-		return statement;
+		return _query_sync(_primary, q, args_in...);
 	}
 
 	template <typename Type, typename Table, typename Where, typename Order, typename... ArgsIn>
-	auto query(const sql::query<Type, Table, Where, Order>& q, ArgsIn&&... args_in) {
-		return this->_worker.schedule([this, argt = std::forward_as_tuple(q, args_in...)]() {
-			return []<size_t... Ns>(mysql_database *self, auto&& tuple, std::index_sequence<Ns...>) {
-				return self->query_sync(std::get<Ns>(tuple)...);
-			}(this, argt, std::make_index_sequence<sizeof...(ArgsIn) + 1>{});
+	auto query(session for_session, const sql::query<Type, Table, Where, Order>& q, ArgsIn&&... args_in) {
+		endpoint& server = _route(q, for_session);
+
+		return server.executor.schedule([this, &server, for_session, argt = std::forward_as_tuple(q, args_in...)]() {
+			return []<size_t... Ns>(mysql_database *self, endpoint& server, session for_session, auto&& tuple, std::index_sequence<Ns...>) {
+				return self->_query_sync(server, for_session, std::get<Ns>(tuple)...);
+			}(this, server, for_session, argt, std::make_index_sequence<sizeof...(ArgsIn) + 1>{});
 		});
 	}
 
+	template <typename Type, typename Table, typename Where, typename Order, typename... ArgsIn>
+	auto query(const sql::query<Type, Table, Where, Order>& q, ArgsIn&&... args_in) {
+		return query(session{}, q, std::forward<ArgsIn>(args_in)...);
+	}
+
 	template <typename... Args>
 	auto query_sync(std::string_view sql, const Args&... args) {
-		auto statement = prepare_sync(sql);
-		if constexpr (sizeof...(Args) > 0) {
-			statement.bind(args...);
-		}
-		if (mysql_stmt_execute(statement.get()) != 0) {
-			throw database_exception{mysql_stmt_error(statement.get())};
-		}
-		return statement;
+		return _query_sync(_primary, sql, args...);
 	}
 
 	template <typename... Args>
-	auto query(std::string sql, Args&&... args) {
-		return this->_worker.schedule([argt = std::forward_as_tuple(this, std::move(sql), std::forward<Args>(args))] {
-			return std::apply(&mysql_database::query_sync, argt);
+	auto query(session for_session, std::string sql, Args&&... args) {
+		endpoint& server = _route(sql, for_session);
+
+		return server.executor.schedule([this, &server, for_session, argt = std::make_tuple(std::move(sql), std::forward<Args>(args)...)] {
+			return []<size_t... Ns>(mysql_database *self, endpoint& server, session for_session, auto&& tuple, std::index_sequence<Ns...>) {
+				return self->_query_sync(server, for_session, std::get<Ns>(tuple)...);
+			}(this, server, for_session, argt, std::make_index_sequence<sizeof...(Args) + 1>{});
 		});
 	}
 
+	template <typename... Args>
+	auto query(std::string sql, Args&&... args) {
+		return query(session{}, std::move(sql), std::forward<Args>(args)...);
+	}
+
 	template <query_type QueryType, typename DataType, size_t Placeholders>
 	requires (QueryType != query_dynamic)
 	auto fetch(mysql_prepared_statement<QueryType, DataType, Placeholders>& statement) {
-		return this->_worker.schedule([this, &statement]() {
+		return _endpoint_of(statement.get()).executor.schedule([this, &statement]() {
 			return statement.fetch();
 		});
 	}
@@ -550,14 +784,14 @@ public:
 	template <query_type QueryType, typename DataType, size_t Placeholders>
 	requires (QueryType != query_dynamic)
 	auto fetch_all(mysql_prepared_statement<QueryType, DataType, Placeholders>& statement) {
-		return this->_worker.schedule([this, &statement]() {
+		return _endpoint_of(statement.get()).executor.schedule([this, &statement]() {
 			return statement.fetch_all();
 		});
 	}
 
 	template <typename Out>
 	auto fetch(mysql_prepared_statement<query_dynamic>& statement) {
-		return this->_worker.schedule([this, &statement]() {
+		return _endpoint_of(statement.get()).executor.schedule([this, &statement]() {
 			if constexpr (is_specialization_v<Out, std::vector>) {
 				return statement.fetch_all<std::ranges::range_value_t<Out>>();
 			} else {
@@ -568,7 +802,7 @@ public:
 
 	template <typename Out>
 	auto fetch_all(mysql_prepared_statement<query_dynamic>& statement) {
-		return this->_worker.schedule([this, &statement]() {
+		return _endpoint_of(statement.get()).executor.schedule([this, &statement]() {
 			return statement.fetch_all<Out>();
 		});
 	}
@@ -585,14 +819,21 @@ public:
 	}
 
 	template <typename Type, typename Table, typename Where, typename Order, typename... ArgsIn>
-	auto execute(const sql::query<Type, Table, Where, Order>& q, ArgsIn&&... args_in) {
-		return this->_worker.schedule([this, argt = std::forward_as_tuple(q, args_in...)]() {
-			return []<size_t... Ns>(mysql_database *self, auto&& tuple, std::index_sequence<Ns...>) {
-				return self->execute_sync(std::get<Ns>(tuple)...);
-			}(this, argt, std::make_index_sequence<sizeof...(ArgsIn) + 1>{});
+	auto execute(session for_session, const sql::query<Type, Table, Where, Order>& q, ArgsIn&&... args_in) {
+		endpoint& server = _route(q, for_session);
+
+		return server.executor.schedule([this, &server, for_session, argt = std::forward_as_tuple(q, args_in...)]() {
+			return []<size_t... Ns>(mysql_database *self, endpoint& server, session for_session, auto&& tuple, std::index_sequence<Ns...>) {
+				return self->_execute_sync(server, for_session, std::get<Ns>(tuple)...);
+			}(this, server, for_session, argt, std::make_index_sequence<sizeof...(ArgsIn) + 1>{});
 		});
 	}
 
+	template <typename Type, typename Table, typename Where, typename Order, typename... ArgsIn>
+	auto execute(const sql::query<Type, Table, Where, Order>& q, ArgsIn&&... args_in) {
+		return execute(session{}, q, std::forward<ArgsIn>(args_in)...);
+	}
+
 	template <query_type QueryType, typename DataType, size_t Placeholders, typename... ArgsIn>
 	requires (QueryType != query_dynamic)
 	auto execute_sync(mysql_prepared_statement<QueryType, DataType, Placeholders>& statement, ArgsIn&&... args_in) {
@@ -603,25 +844,17 @@ public:
 
 	template <typename Out, typename... ArgsIn>
 	auto execute_sync(std::string_view sql, ArgsIn&&... args_in) {
-		auto statement = query_sync(sql, std::forward<ArgsIn>(args_in)...);
-
-		if constexpr (is_specialization_v<Out, std::vector>) {
-			return statement.template fetch_all<std::ranges::range_value_t<Out>>();
-		} else {
-			return statement.template fetch<Out>();
-		}
+		return _execute_sync<Out>(_primary, sql, std::forward<ArgsIn>(args_in)...);
 	}
 
 	template <typename Type, typename Table, typename Where, typename Order, typename... ArgsIn>
 	auto execute_sync(const sql::query<Type, Table, Where, Order>& q, ArgsIn&&... args_in) {
-		auto statement = query_sync(q, std::forward<ArgsIn>(args_in)...);
-
-		return statement.fetch_all();
+		return _execute_sync(_primary, q, std::forward<ArgsIn>(args_in)...);
 	}
 
 	template <typename Out, typename... ArgsIn>
 	auto execute(mysql_prepared_statement<query_dynamic>& statement, ArgsIn&&... args_in) {
-		return this->_worker.schedule([this, argt = std::forward_as_tuple(statement, std::forward<ArgsIn>(args_in)...)] {
+		return _endpoint_of(statement.get()).executor.schedule([this, argt = std::forward_as_tuple(statement, std::forward<ArgsIn>(args_in)...)] {
 			return []<size_t... Ns>(mysql_database *self, auto&& tuple, std::index_sequence<Ns...>) {
 				return self->execute_sync<Out>(std::get<Ns>(tuple)...);
 			}(this, argt, std::make_index_sequence<sizeof...(ArgsIn) + 1>{});
@@ -631,7 +864,7 @@ public:
 	template <query_type QueryType, typename DataType, size_t Placeholders, typename... ArgsIn>
 	requires (QueryType != query_dynamic)
 	auto execute(mysql_prepared_statement<QueryType, DataType, Placeholders>& statement, ArgsIn&&... args_in) {
-		return this->_worker.schedule([this, argt = std::forward_as_tuple(statement, std::forward<ArgsIn>(args_in)...)] {
+		return _endpoint_of(statement.get()).executor.schedule([this, argt = std::forward_as_tuple(statement, std::forward<ArgsIn>(args_in)...)] {
 			return []<size_t... Ns>(mysql_database *self, auto&& tuple, std::index_sequence<Ns...>) {
 				return self->execute_sync(std::get<Ns>(tuple)...);
 			}(this, argt, std::make_index_sequence<sizeof...(ArgsIn) + 1>{});
@@ -639,23 +872,173 @@ public:
 	}
 
 	template <typename Out, typename... ArgsIn>
-	auto execute(std::string_view sql, ArgsIn&&... args_in) {
-		return this->_worker.schedule([this, argt = std::forward_as_tuple(std::string{sql}, std::forward<ArgsIn>(args_in)...)] {
-			return []<size_t... Ns>(mysql_database *self, auto&& tuple, std::index_sequence<Ns...>) {
-				return self->execute_sync<Out>(std::get<Ns>(tuple)...);
-			}(this, argt, std::make_index_sequence<sizeof...(ArgsIn) + 1>{});
+	auto execute(session for_session, std::string_view sql, ArgsIn&&... args_in) {
+		endpoint& server = _route(sql, for_session);
+
+		return server.executor.schedule([this, &server, for_session, argt = std::make_tuple(std::string{sql}, std::forward<ArgsIn>(args_in)...)] {
+			return []<size_t... Ns>(mysql_database *self, endpoint& server, session for_session, auto&& tuple, std::index_sequence<Ns...>) {
+				return self->_execute_sync<Out>(server, for_session, std::get<Ns>(tuple)...);
+			}(this, server, for_session, argt, std::make_index_sequence<sizeof...(ArgsIn) + 1>{});
 		});
 	}
 
+	template <typename Out, typename... ArgsIn>
+	auto execute(std::string_view sql, ArgsIn&&... args_in) {
+		return execute<Out>(session{}, sql, std::forward<ArgsIn>(args_in)...);
+	}
+
 private:
 	using request = std::move_only_function<void()>;
 
-	mysql_database(const connection_info& info, std::nullopt_t);
-	MYSQL* connect();
+	/* Replicas that can't be reached or don't report a lag */
+	static constexpr int64_t unavailable = std::numeric_limits<int64_t>::max();
+
+	/**
+	 * One server, with its own connection and the thread that owns it.
+	 */
+	struct endpoint {
+		endpoint(const connection_info& info);
+
+		bool connect();
+
+		connection_info info;
+		managed_ptr<MYSQL, &mysql_close> connection;
+		std::atomic<bool> connected = false;
+		/* Seconds behind the primary as of the last probe */
+		std::atomic<int64_t> lag = unavailable;
+		std::atomic<app_duration::rep> probed_at = 0;
+		std::atomic<bool> probing = false;
+		/* Also used by the synchronous calls, from other threads */
+		std::mutex statements_mutex;
+		statement_cache statements;
+		worker executor;
+	};
+
+	template <size_t Placeholders = std::numeric_limits<size_t>::max(), typename Type, typename Table, typename Where, typename Order>
+	auto _prepare_sync(endpoint& server, const sql::query<Type, Table, Where, Order>& q) {
+		using query_helper = query_type_helper<sql::query<Type, Table, Where, Order>>;
+		static_assert(query_helper::value != query_error, "unrecognized query");
+
+		auto stmt = managed_ptr<MYSQL_STMT, &mysql_stmt_close>{mysql_stmt_init(server.connection.get())};
+		auto str = q.to_string();
+		if (mysql_stmt_prepare(stmt.get(), str.data(), str.size()) != 0) {
+			throw database_exception{mysql_error(server.connection.get())};
+		}
+		if constexpr (Placeholders != std::numeric_limits<size_t>::max()) {
+			if (auto count = mysql_stmt_param_count(stmt.get()); count != Placeholders) {
+				throw database_exception{std::format("query has {} placeholders but the statement was declared with {}", count, Placeholders)};
+			}
+		}
+		return mysql_prepared_statement<query_helper::value, typename query_helper::data_type, Placeholders>{std::move(stmt)};
+	}
+
+	auto _prepare_sync(endpoint& server, std::string_view sql) -> mysql_prepared_statement<query_dynamic> {
+		auto stmt = managed_ptr<MYSQL_STMT, &mysql_stmt_close>{mysql_stmt_init(server.connection.get())};
+		if (mysql_stmt_prepare(stmt.get(), sql.data(), sql.size()) != 0) {
+			throw database_exception{mysql_error(server.connection.get())};
+		}
+		return mysql_prepared_statement<query_dynamic>{std::move(stmt)};
+	}
+
+	/**
+	 * A statement for `sql` from the server's cache, prepared if none is idle.
+	 */
+	statement_lease _lease(endpoint& server, std::string_view sql);
+
+	template <typename Type, typename Table, typename Where, typename Order, typename... Args>
+	statement_lease _query_sync(endpoint& server, const sql::query<Type, Table, Where, Order>& q, const Args&... args_in) {
+		return _query_sync(server, session{}, q, args_in...);
+	}
+
+	template <typename Type, typename Table, typename Where, typename Order, typename... Args>
+	statement_lease _query_sync(endpoint& server, session for_session, const sql::query<Type, Table, Where, Order>& q, const Args&... args_in) {
+		static_assert(query_type_helper<sql::query<Type, Table, Where, Order>>::value != query_error, "unrecognized query");
+		auto str = q.to_string();
+
+		return _query_sync(server, for_session, std::string_view{str.data(), str.size()}, args_in...);
+	}
+
+	template <typename... Args>
+	statement_lease _query_sync(endpoint& server, std::string_view sql, const Args&... args) {
+		return _query_sync(server, session{}, sql, args...);
+	}
+
+	template <typename... Args>
+	statement_lease _query_sync(endpoint& server, session for_session, std::string_view sql, const Args&... args) {
+		statement_lease statement = _lease(server, sql);
+
+		try {
+			if constexpr (sizeof...(Args) > 0) {
+				statement->bind(args...);
+			}
+			_execute(statement->get(), for_session);
+		} catch (...) {
+			statement.discard();
+			throw;
+		}
+		return statement;
+	}
+
+	template <typename Out, typename... ArgsIn>
+	auto _execute_sync(endpoint& server, std::string_view sql, ArgsIn&&... args_in) {
+		return _execute_sync<Out>(server, session{}, sql, std::forward<ArgsIn>(args_in)...);
+	}
+
+	template <typename Out, typename... ArgsIn>
+	auto _execute_sync(endpoint& server, session for_session, std::string_view sql, ArgsIn&&... args_in) {
+		statement_lease statement = _query_sync(server, for_session, sql, std::forward<ArgsIn>(args_in)...);
+
+		if constexpr (is_specialization_v<Out, std::vector>) {
+			return statement->template fetch_all<std::ranges::range_value_t<Out>>();
+		} else {
+			return statement->template fetch<Out>();
+		}
+	}
+
+	template <typename Type, typename Table, typename Where, typename Order, typename... ArgsIn>
+	auto _execute_sync(endpoint& server, const sql::query<Type, Table, Where, Order>& q, ArgsIn&&... args_in) {
+		return _execute_sync(server, session{}, q, std::forward<ArgsIn>(args_in)...);
+	}
+
+	template <typename Type, typename Table, typename Where, typename Order, typename... ArgsIn>
+	auto _execute_sync(endpoint& server, session for_session, const sql::query<Type, Table, Where, Order>& q, ArgsIn&&... args_in) {
+		statement_lease statement = _query_sync(server, for_session, q, std::forward<ArgsIn>(args_in)...);
+
+		return statement->template fetch_all<typename query_type_helper<sql::query<Type, Table, Where, Order>>::data_type>();
+	}
+
+	/**
+	 * Execute a bound statement, statements that return no result set are writes and start the session's read-your-writes window.
+	 */
+	void _execute(MYSQL_STMT* stmt, session for_session = {});
+
+	template <typename Type, typename Table, typename Where, typename Order>
+	endpoint& _route(const sql::query<Type, Table, Where, Order>&, session for_session = {}) {
+		return query_type_helper<sql::query<Type, Table, Where, Order>>::value == query_select ? _pick_replica(for_session) : _primary;
+	}
+
+	endpoint& _route(std::string_view sql, session for_session = {}) {
+		return is_read_only(sql) ? _pick_replica(for_session) : _primary;
+	}
 
-	connection_info db_info;
-	managed_ptr<MYSQL, &mysql_close> connection;
-	worker _worker;
+	endpoint& _pick_replica(session for_session);
+	bool _wrote_recently(session for_session, int64_t now);
+	endpoint& _endpoint_of(MYSQL_STMT* stmt) noexcept;
+	void _probe(endpoint& replica);
+	static int64_t _measure_lag(endpoint& replica) noexcept;
+
+	endpoint _primary;
+	std::vector<std::unique_ptr<endpoint>> _replicas;
+	seconds _max_replica_lag;
+	seconds _read_your_writes;
+	seconds _probe_interval;
+	/* Last write made without a session */
+	std::atomic<app_duration::rep> _last_write = 0;
+	/* Last write of each session, expired ones are swept when the map has doubled since the last sweep */
+	std::shared_mutex _session_writes_mutex;
+	std::unordered_map<uint64_t, app_duration::rep> _session_writes;
+	size_t _sweep_session_writes_at = 64;
+	std::atomic<size_t> _next_replica = 0;
 };
 
 using database = mysql_database;
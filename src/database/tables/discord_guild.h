@@ -5,8 +5,15 @@
 
 namespace mimiron::tables {
 
+/**
+ * Row of `discord_guild`.
+ *
+ * `updated_at` is the unix time of the last change to the row, maintained by MySQL through
+ * `updated_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP`.
+ */
 struct discord_guild_entry {
 	uint64_t snowflake;
+	int64_t updated_at;
 };
 
 }
@@ -5,12 +5,18 @@
 
 namespace mimiron::tables {
 
+/**
+ * Row of `wow_guild`.
+ *
+ * `updated_at` is maintained by MySQL the same way as discord_guild_entry::updated_at.
+ */
 struct wow_guild_entry {
 	uint64_t discord_guild_id;
   uint8_t wow_guild_id;
   uint16_t server_id;
   uint16_t region_id;
   std::string name;
+  int64_t updated_at;
 };
 
 using wow_guild = sql::table<"wow_guild", wow_guild_entry>;
@@ -15,13 +15,13 @@ discord_guild::discord_guild(const tables::discord_guild_entry& db_entry) :
 discord_guild::discord_guild(const discord_guild& other) :
 	_id{other._id},
 	_bot_member{other._bot_member},
-	_bot_member_last_updated{other._bot_member_last_updated} {
+	_bot_member_generation{other._bot_member_generation} {
 }
 
 discord_guild& discord_guild::operator=(const discord_guild& other) {
 	_id = other._id;
 	_bot_member = other._bot_member;
-	_bot_member_last_updated = other._bot_member_last_updated;
+	_bot_member_generation = other._bot_member_generation;
 	return *this;
 }
 
@@ -29,10 +29,10 @@ dpp::snowflake discord_guild::id() const noexcept {
 	return _id;
 }
 
-app_timestamp discord_guild::last_updated_bot_member() const {
+uint64_t discord_guild::bot_member_generation() const {
 	std::shared_lock lock{mutex};
 
-	return _bot_member_last_updated;
+	return _bot_member_generation;
 }
 
 dpp::guild_member discord_guild::bot_member() const {
@@ -47,7 +47,7 @@ uint32_t discord_guild::bot_color() const {
 	return _bot_color;
 }
 
-void discord_guild::update_bot_member(dpp::guild_member const& member, dpp::role_map const& roles) {
+void discord_guild::update_bot_member(dpp::guild_member const& member, dpp::role_map const& roles, uint64_t generation) {
 	auto color = mimiron_color;
 	uint8_t role_position = std::numeric_limits<uint8_t>::max();
 	if (!roles.empty()) {
@@ -66,7 +66,7 @@ void discord_guild::update_bot_member(dpp::guild_member const& member, dpp::role
 	}
 	std::unique_lock lock{mutex};
 
-	_bot_member_last_updated = app_clock::now();
+	_bot_member_generation = generation;
 	_bot_member = member;
 	_bot_color = color;
 }
@@ -24,17 +24,18 @@ public:
 
 	dpp::snowflake id() const noexcept;
 
-	app_timestamp last_updated_bot_member() const;
+	/* Generation the bot member was fetched in, see mimiron::get_bot_member. 0 if it never was */
+	uint64_t bot_member_generation() const;
 	dpp::guild_member bot_member() const;
 	uint32_t bot_color() const;
 
-	void update_bot_member(dpp::guild_member const& member, dpp::role_map const& roles = {});
+	void update_bot_member(dpp::guild_member const& member, dpp::role_map const& roles, uint64_t generation);
 
 private:
 	mutable std::shared_mutex mutex;
 	dpp::snowflake _id;
 	dpp::guild_member _bot_member;
-	app_timestamp _bot_member_last_updated;
+	uint64_t _bot_member_generation = 0;
 	uint64_t _bot_color;
 };
 
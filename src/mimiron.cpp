@@ -3,6 +3,8 @@
 #include <fstream>
 #include <atomic>
 #include <memory>
+#include <thread>
+#include <unordered_map>
 
 #include <dpp/once.h>
 #include <termcolor/termcolor.hpp>
@@ -17,6 +19,12 @@ namespace mimiron {
 
 namespace {
 
+constexpr auto discord_guild_changes = "SELECT snowflake, UNIX_TIMESTAMP(updated_at) FROM discord_guild WHERE updated_at >= FROM_UNIXTIME(?)"sv;
+constexpr auto wow_guild_changes = "SELECT discord_guild_id, wow_guild_id, server_id, region_id, name, UNIX_TIMESTAMP(updated_at) FROM wow_guild WHERE updated_at >= FROM_UNIXTIME(?)"sv;
+
+/* How long the bot's member in a guild missing from DPP's cache is reused before being fetched again */
+constexpr auto bot_member_lifetime = 30min;
+
 nlohmann::json load_config(const std::filesystem::path &file_path) {
 	std::ifstream fs{file_path};
 
@@ -30,15 +38,129 @@ nlohmann::json load_config(const std::filesystem::path &file_path) {
 	return j;
 }
 
+sql::mysql_database::connection_info load_connection_info(const nlohmann::json &j) {
+	return {
+		.host = j.value("host", "localhost"),
+		.username = j.value("username", "root"),
+		.password = j.value("password", "root"),
+		.database = j.value("database", "mimiron"),
+		.port = j.value("port", uint16_t{3307})
+	};
+}
+
+/**
+ * Reads the "database" object of the config: the primary's connection info at its root,
+ * and optionally a "replicas" array with the same fields for each read replica.
+ */
+sql::mysql_database::topology load_database_topology(const nlohmann::json &config) {
+	const nlohmann::json &j = config.contains("database") ? config["database"] : nlohmann::json::object();
+	sql::mysql_database::topology servers{.primary = load_connection_info(j)};
+
+	if (auto it = j.find("replicas"); it != j.end()) {
+		for (const nlohmann::json &replica : *it) {
+			servers.replicas.push_back(load_connection_info(replica));
+		}
+	}
+	servers.max_replica_lag = seconds{j.value("max_replica_lag", servers.max_replica_lag.count())};
+	servers.read_your_writes = seconds{j.value("read_your_writes", servers.read_your_writes.count())};
+	servers.queue_capacity = j.value("queue_capacity", size_t{1024});
+	return servers;
+}
+
+std::vector<wow::api_credentials> load_api_credentials(const nlohmann::json &config) {
+	std::vector<wow::api_credentials> clients;
+
+	if (config.contains("wow_api_id")) {
+		clients.push_back({config.at("wow_api_id").get<std::string>(), config.at("wow_api_key").get<std::string>()});
+	}
+	if (auto it = config.find("wow_api_clients"); it != config.end()) {
+		for (const nlohmann::json &client : *it) {
+			clients.push_back({client.at("id").get<std::string>(), client.at("key").get<std::string>()});
+		}
+	}
+	return clients;
+}
+
+wow::api_handler::queue_settings load_api_queue_settings(const nlohmann::json &config) {
+	wow::api_handler::queue_settings settings;
+
+	settings.max_in_flight = config.value("api_max_in_flight", settings.max_in_flight);
+	settings.max_waiting = config.value("api_max_waiting", settings.max_waiting);
+	settings.requests_per_second = config.value("api_requests_per_second", settings.requests_per_second);
+	settings.requests_per_hour = config.value("api_requests_per_hour", settings.requests_per_hour);
+	settings.retry.max_attempts = config.value("api_max_attempts", settings.retry.max_attempts);
+	settings.retry.deadline = milliseconds{config.value("api_retry_deadline_ms", std::chrono::duration_cast<milliseconds>(settings.retry.deadline).count())};
+	settings.hedging.max_ratio = config.value("api_hedge_ratio", settings.hedging.max_ratio);
+	settings.tenant_burst = config.value("api_guild_burst", settings.tenant_burst);
+	if (auto it = config.find("api_guild_weights"); it != config.end()) {
+		for (const auto& [guild, weight] : it->items()) {
+			settings.tenant_weights[dpp::snowflake{guild}] = weight.get<double>();
+		}
+	}
+	if (auto it = config.find("api_overflow_policy"); it != config.end()) {
+		settings.policy = parse_overflow_policy(it->get<std::string>());
+	}
+	return settings;
+}
+
+wow::api_handler::endpoints load_api_endpoints(const nlohmann::json &config) {
+	wow::api_handler::endpoints targets;
+
+	targets.api_base_url = config.value("wow_api_base_url", targets.api_base_url);
+	targets.oauth_url = config.value("wow_oauth_url", targets.oauth_url);
+	targets.record_fixtures = config.value("wow_api_record_fixtures", std::string{});
+	return targets;
+}
+
 }
 
 mimiron::mimiron(std::span<char *const> args) :
 	config{load_config(args.size() < 2 ? "config.json" : args[1])},
 	cluster{config["discord_token"], dpp::i_default_intents, 0, 0, 1, true, dpp::cache_policy::cpol_balanced},
-	_resource_manager{cluster, config["wow_api_id"], config["wow_api_key"]} {
+	_workers{config.value("worker_threads", size_t{std::thread::hardware_concurrency()})},
+	_resource_manager{cluster, _workers, _timers, load_api_credentials(config), load_api_queue_settings(config), load_api_endpoints(config)},
+	_database{load_database_topology(config)} {
+	_workers.set_capacity(config.value("worker_queue_capacity", size_t{4096}));
+	if (auto it = config.find("wow_locales"); it != config.end()) {
+		std::vector<wow::locale> kept;
+
+		for (const nlohmann::json &code : *it) {
+			wow::locale language = wow::to_locale(code.get<std::string>());
+
+			if (language == wow::locale::unknown) {
+				throw exception{"unknown locale " + code.get<std::string>()};
+			}
+			kept.push_back(language);
+		}
+		wow::localized_string::keep_locales(kept);
+	}
+	if (auto it = config.find("wow_api_locale"); it != config.end()) {
+		wow::locale language = wow::to_locale(it->get<std::string>());
+
+		if (language == wow::locale::unknown) {
+			throw exception{"unknown locale " + it->get<std::string>()};
+		}
+		_resource_manager.set_locale(language);
+	}
 	log_min = 0;
 	cluster.on_log([this]( dpp::log_t const& log) { _log(log); });
 }
+
+mimiron::~mimiron() {
+	/* The timers' callbacks and the work they start use the members below, nothing may run once those start going away */
+	_timers.cancel(_refresh_guilds_timer);
+	_timers.cancel(_api_usage_timer);
+	_timers.cancel(_bot_member_timer);
+	/* Background refreshes need the pool to finish, wait for them before stopping it */
+	_resource_manager.stop();
+	_timers.stop();
+	_workers.stop().sync_wait();
+	/* A refresh already under way finishes on the database's threads */
+	while (_refreshing_guilds.load()) {
+		std::this_thread::yield();
+	}
+}
+
 void mimiron::_log(dpp::log_t const& log_event) const {
 	log(log_event.severity, log_event.message);
 }
@@ -113,6 +235,7 @@ dpp::coroutine<dpp::embed> mimiron::make_default_embed(dpp::snowflake guild_for,
 
 dpp::coroutine<dpp::guild_member> mimiron::get_bot_member(dpp::snowflake guild) {
 	auto [guild_settings, _] = discord_guild_cache().try_emplace(guild, guild);
+	uint64_t generation = _bot_member_generation.load(std::memory_order_relaxed);
 
 	if (dpp::guild* g = dpp::find_guild(guild)) {
 		if (auto it = g->members.find(cluster.me.id); it != g->members.end()) {
@@ -137,12 +260,12 @@ dpp::coroutine<dpp::guild_member> mimiron::get_bot_member(dpp::snowflake guild)
 				}
 			}
 
-			guild_settings->second.update_bot_member(it->second, roles);
+			guild_settings->second.update_bot_member(it->second, roles, generation);
 			co_return it->second;
 		}
 	}
-	auto last_update = guild_settings->second.last_updated_bot_member();
-	if (!(last_update.time_since_epoch() == app_clock::duration{}) && app_clock::now() - last_update < std::chrono::minutes(30)) {
+	/* Stale once the timer started in run() has moved on to the next generation */
+	if (guild_settings->second.bot_member_generation() == generation) {
 		co_return guild_settings->second.bot_member();
 	}
 	auto result = co_await cluster.co_guild_get_member(guild, cluster.me.id);
@@ -156,7 +279,7 @@ dpp::coroutine<dpp::guild_member> mimiron::get_bot_member(dpp::snowflake guild)
 	if (!result.is_error()) {
 		role_map = std::get<dpp::role_map>(std::move(result.value));
 	}
-	guild_settings->second.update_bot_member(member, role_map);
+	guild_settings->second.update_bot_member(member, role_map, generation);
 	co_return member;
 }
 
@@ -204,39 +327,85 @@ void mimiron::_init_database() {
 	}
 }
 
+void mimiron::_apply_guild(tables::discord_guild_entry const& entry) {
+	/* A discord guild has nothing but its id to keep in sync, a changed row is one added since the last poll */
+	auto [guild, _] = _discord_guild_cache.try_emplace(entry.snowflake, entry);
+
+	_discord_guilds_synced_at = std::max(_discord_guilds_synced_at, entry.updated_at);
+	log(dpp::ll_trace, "loaded guild {}", static_cast<uint64_t>(guild->second.id()));
+}
+
+void mimiron::_apply_guilds(std::span<const tables::wow_guild_entry> entries) {
+	std::unordered_map<uint64_t, std::vector<const tables::wow_guild_entry*>> changed;
+
+	for (const tables::wow_guild_entry& entry : entries) {
+		changed[entry.discord_guild_id].push_back(&entry);
+		_wow_guilds_synced_at = std::max(_wow_guilds_synced_at, entry.updated_at);
+	}
+	/* Command handlers keep iterating the list they found: each discord guild gets a new one with all of its changes,
+	 * merged into the current one under the cache's lock so that a change made in the meantime isn't lost */
+	for (const auto& [discord_guild_id, guild_entries] : changed) {
+		_wow_guild_cache.update(dpp::snowflake{discord_guild_id}, [&](const std::vector<wow::guild>* current) {
+			std::vector<wow::guild> guilds = current ? *current : std::vector<wow::guild>{};
+
+			for (const tables::wow_guild_entry* entry : guild_entries) {
+				if (auto existing = std::ranges::find(guilds, entry->wow_guild_id, &wow::guild::wow_id); existing != guilds.end()) {
+					existing->set_name(entry->name);
+				}
+				else {
+					guilds.emplace_back(entry->discord_guild_id, entry->wow_guild_id, entry->name);
+				}
+			}
+			return guilds;
+		});
+		for (const tables::wow_guild_entry* entry : guild_entries) {
+			log(dpp::ll_trace, "loaded guild <{}> with id {}:{}", entry->name, entry->discord_guild_id, entry->wow_guild_id);
+		}
+	}
+}
+
 void mimiron::_load_guilds() {
 	{
 		cluster.log(dpp::ll_info, "loading discord guilds...");
-		auto discord_guilds = _database.execute_sync(sql::select<tables::discord_guild_entry>.from("discord_guild"));
+		auto discord_guilds = _database.execute_sync<std::vector<tables::discord_guild_entry>>(discord_guild_changes, _discord_guilds_synced_at);
 		for (const tables::discord_guild_entry& entry : discord_guilds) {
-			auto [guild, inserted] = _discord_guild_cache.try_emplace(entry.snowflake, entry);
-			if (!inserted) {
-				guild->second = discord_guild{entry};
-			}
-			log(dpp::ll_trace, "loaded guild {}", static_cast<uint64_t>(guild->second.id()));
+			_apply_guild(entry);
 		}
 		cluster.log(dpp::ll_info, std::format("loaded {} guilds\n", discord_guilds.size()));
 	}
 
 	{
 		cluster.log(dpp::ll_info, "loading wow guilds...");
-		auto wow_guilds = _database.execute_sync(sql::select<tables::wow_guild_entry>.from("wow_guild"));
-		for (const tables::wow_guild_entry& entry : wow_guilds) {
-			auto cache_entry = _wow_guild_cache[entry.discord_guild_id];
-			auto& [_, guilds] = *cache_entry;
-			wow::guild* this_guild;
-			if (auto it = std::ranges::find(guilds, entry.wow_guild_id, &wow::guild::wow_id); it != guilds.end()) {
-				this_guild = &(*it);
-			}
-			else {
-				this_guild = &guilds.emplace_back(entry.discord_guild_id, entry.wow_guild_id, entry.name);
-			}
-			log(dpp::ll_trace, "loaded guild <{}> with id {}:{}", this_guild->name(), static_cast<uint64_t>(this_guild->discord_guild()), this_guild->wow_id());
-		}
+		auto wow_guilds = _database.execute_sync<std::vector<tables::wow_guild_entry>>(wow_guild_changes, _wow_guilds_synced_at);
+		_apply_guilds(wow_guilds);
 		cluster.log(dpp::ll_info, std::format("loaded {} guilds\n", wow_guilds.size()));
 	}
 }
 
+dpp::job mimiron::_refresh_guilds() {
+	if (_refreshing_guilds.exchange(true)) {
+		co_return;
+	}
+	/* Rows are selected with >= on the last timestamp we applied so that changes committed in that same second aren't missed,
+	 * applying a row twice is harmless.
+	 * The polls go to a replica, which may not have had rows older than that timestamp yet when we last read from it or from
+	 * another server: going back by the lag a replica is allowed to have picks them up. */
+	try {
+		int64_t lag = _database.max_replica_lag().count();
+		auto discord_guilds = co_await _database.execute<std::vector<tables::discord_guild_entry>>(discord_guild_changes, _discord_guilds_synced_at - lag);
+		for (const tables::discord_guild_entry& entry : discord_guilds) {
+			_apply_guild(entry);
+		}
+
+		auto wow_guilds = co_await _database.execute<std::vector<tables::wow_guild_entry>>(wow_guild_changes, _wow_guilds_synced_at - lag);
+		_apply_guilds(wow_guilds);
+		log(dpp::ll_debug, "refreshed {} discord guilds and {} wow guilds", discord_guilds.size(), wow_guilds.size());
+	} catch (const std::exception &e) {
+		log(dpp::ll_error, "error while refreshing guilds: {}", e.what());
+	}
+	_refreshing_guilds = false;
+}
+
 
 
 int mimiron::run() {
@@ -256,6 +425,20 @@ int mimiron::run() {
 		return -1;
 	}
 
+	auto refresh_interval = seconds{config.value("guild_refresh_interval", seconds::rep{60})};
+	_refresh_guilds_timer = _timers.every(refresh_interval, [this] {
+		_refresh_guilds();
+	}, refresh_interval / 10);
+
+	/* Who is using the API and how much gets refused, to tune the queue settings from */
+	_api_usage_timer = _timers.every(seconds{config.value("api_usage_log_interval", seconds::rep{300})}, [this] {
+		log(dpp::ll_debug, "WoW API usage: {}", to_string(_resource_manager.api_usage()));
+	});
+
+	_bot_member_timer = _timers.every(bot_member_lifetime, [this] {
+		_bot_member_generation.fetch_add(1, std::memory_order_relaxed);
+	});
+
 	try {
 		auto result = _resource_manager.start().sync_wait_for(1min);
 		if (!result) {
@@ -9,8 +9,11 @@
 
 #include "database/database.h"
 #include "database/tables/discord_guild.h"
+#include "database/tables/wow_guild.h"
 #include "commands/command_handler.h"
 #include "tools/cache.h"
+#include "tools/thread_pool.h"
+#include "tools/timer_wheel.h"
 #include "wow/guild.h"
 #include "discord_guild.h"
 
@@ -22,7 +25,7 @@ class mimiron {
 public:
 	mimiron(std::span<char *const> args);
 
-	~mimiron() = default;
+	~mimiron();
 
 	int run();
 
@@ -55,6 +58,24 @@ public:
 		return _resource_manager;
 	}
 
+	/**
+	 * Threads for blocking or CPU-heavy work, so that it doesn't hold up DPP's threads.
+	 */
+	thread_pool& workers() noexcept {
+		return _workers;
+	}
+
+	timer_wheel& timers() noexcept {
+		return _timers;
+	}
+
+	/**
+	 * Whether the bot is too busy to take on new commands, which should then be answered right away rather than left to time out.
+	 */
+	bool overloaded() const noexcept {
+		return _workers.overloaded() || _database.overloaded() || _resource_manager.overloaded();
+	}
+
 	dpp::coroutine<dpp::guild_member> get_bot_member(dpp::snowflake guild);
 
 	dpp::coroutine<dpp::embed> make_default_embed(dpp::snowflake guild_for = {}, dpp::user const* user_for = nullptr, dpp::guild_member const* member_for = nullptr);
@@ -66,20 +87,34 @@ private:
 
 	void _init_database();
 	void _load_guilds();
+	dpp::job _refresh_guilds();
+
+	void _apply_guild(tables::discord_guild_entry const& entry);
+	void _apply_guilds(std::span<const tables::wow_guild_entry> entries);
 
 	nlohmann::json config;
 	uint64_t log_min = 0;
 	dpp::cluster cluster;
+	thread_pool _workers;
+	timer_wheel _timers{_workers};
 	wow::resource_manager _resource_manager;
 	command_handler _command_handler{*this};
-	sql::mysql_database _database{{
-		.password = "root",
-		.database = "mimiron",
-		.port = 3307
-	}};
+	sql::mysql_database _database;
 
 	cache<dpp::snowflake, discord_guild> _discord_guild_cache;
 	wow::guild::cache _wow_guild_cache;
+
+	/* Server-side unix time of the most recent change applied to the caches, for each table */
+	int64_t _discord_guilds_synced_at = 0;
+	int64_t _wow_guilds_synced_at = 0;
+	std::atomic<bool> _refreshing_guilds = false;
+
+	/* Bumped every bot_member_lifetime, which expires every cached bot member at once without a clock check per lookup */
+	std::atomic<uint64_t> _bot_member_generation = 1;
+
+	timer_wheel::timer_id _refresh_guilds_timer = 0;
+	timer_wheel::timer_id _api_usage_timer = 0;
+	timer_wheel::timer_id _bot_member_timer = 0;
 };
 
 }
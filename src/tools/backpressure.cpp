@@ -0,0 +1,190 @@
+#include "tools/backpressure.h"
+
+#include <algorithm>
+#include <format>
+
+#include "tools/thread_pool.h"
+
+namespace mimiron {
+
+overflow_policy parse_overflow_policy(std::string_view name) {
+	if (name == "wait") {
+		return overflow_policy::wait;
+	}
+	if (name == "reject") {
+		return overflow_policy::reject;
+	}
+	if (name == "shed") {
+		return overflow_policy::shed;
+	}
+	throw exception{std::format("unknown overflow policy \"{}\"", name)};
+}
+
+auto admission_gate::ticket::operator=(ticket&& other) noexcept -> ticket& {
+	if (this != &other) {
+		if (_gate) {
+			_gate->_release(_tenant);
+		}
+		_gate = std::exchange(other._gate, nullptr);
+		_tenant = other._tenant;
+	}
+	return *this;
+}
+
+admission_gate::ticket::~ticket() {
+	if (_gate) {
+		_gate->_release(_tenant);
+	}
+}
+
+admission_gate::admission_gate(thread_pool& executor, size_t capacity, overflow_policy policy, size_t max_waiting, lane_scheduler::shares min_share) :
+	_executor{executor},
+	_capacity{std::max<size_t>(capacity, 1)},
+	_policy{policy},
+	_max_waiting{policy == overflow_policy::reject ? 0 : max_waiting},
+	_lanes{min_share}
+{}
+
+void admission_gate::set_tenant_weight(tenant_id tenant, double weight) {
+	std::unique_lock lock{_mutex};
+
+	_weights[tenant] = weight;
+}
+
+void admission_gate::set_tenant_burst(size_t burst) {
+	std::unique_lock lock{_mutex};
+
+	for (fair_queue<awaiter*>& lane : _waiters) {
+		lane.set_burst(burst);
+	}
+}
+
+auto admission_gate::usage() const -> std::vector<tenant_usage> {
+	std::unique_lock lock{_mutex};
+	std::vector<tenant_usage> ret;
+
+	ret.reserve(_usage.size());
+	for (const auto& [tenant, counters] : _usage) {
+		ret.push_back({tenant, counters.in_flight, counters.waiting, counters.admitted, counters.refused});
+	}
+	return ret;
+}
+
+bool admission_gate::_room_to_wait() const noexcept {
+	return _policy != overflow_policy::reject && (_max_waiting == 0 || _waiting < _max_waiting);
+}
+
+void admission_gate::_admit(tenant_id tenant, size_t lane) {
+	usage_counters& counters = _usage[tenant];
+
+	++counters.in_flight;
+	++counters.admitted;
+	_lanes.served(lane);
+}
+
+void admission_gate::_forget_if_idle(tenant_id tenant) noexcept {
+	if (auto it = _usage.find(tenant); it != _usage.end() && it->second.in_flight == 0 && it->second.waiting == 0) {
+		_usage.erase(it);
+	}
+}
+
+void admission_gate::_resume(awaiter* waiter) noexcept {
+	/* Resuming inline would run the waiter's work inside the caller, and a chain of releases would nest */
+	_executor.queue([coroutine = waiter->coroutine]() noexcept {
+		coroutine.resume();
+	});
+}
+
+bool admission_gate::awaiter::await_ready() {
+	std::unique_lock lock{gate._mutex};
+
+	if (gate._waiting == 0 && gate._in_flight.load(std::memory_order_relaxed) < gate._capacity) {
+		gate._in_flight.fetch_add(1, std::memory_order_relaxed);
+		gate._admit(tenant, static_cast<size_t>(level));
+		admitted = true;
+	}
+	return admitted;
+}
+
+bool admission_gate::awaiter::await_suspend(std::coroutine_handle<> handle) {
+	std::unique_lock lock{gate._mutex};
+
+	/* A slot may have been released since await_ready */
+	if (gate._waiting == 0 && gate._in_flight.load(std::memory_order_relaxed) < gate._capacity) {
+		gate._in_flight.fetch_add(1, std::memory_order_relaxed);
+		gate._admit(tenant, static_cast<size_t>(level));
+		admitted = true;
+		return false;
+	}
+	awaiter* victim = nullptr;
+	if (!gate._room_to_wait()) {
+		if (gate._policy == overflow_policy::shed) {
+			/* Make room by dropping a waiter of the lowest priority below us, taken from whoever has the most queued */
+			for (size_t p = 0; p < static_cast<size_t>(level) && !victim; ++p) {
+				victim = gate._waiters[p].pop_heaviest().value_or(nullptr);
+			}
+			/* Or from a tenant of our priority that has clearly more queued than us */
+			if (auto& lane = gate._waiters[static_cast<size_t>(level)]; !victim) {
+				victim = lane.pop_heaviest(lane.queued(tenant) + 1).value_or(nullptr);
+			}
+		}
+		if (!victim) {
+			++gate._usage[tenant].refused;
+			gate._forget_if_idle(tenant);
+			return false;
+		}
+		usage_counters& shed = gate._usage[victim->tenant];
+
+		--gate._waiting;
+		--shed.waiting;
+		++shed.refused;
+		gate._forget_if_idle(victim->tenant);
+		gate._resume(victim);
+	}
+	coroutine = handle;
+	auto weight = gate._weights.find(tenant);
+	gate._waiters[static_cast<size_t>(level)].push(tenant, this, weight == gate._weights.end() ? 1.0 : weight->second);
+	++gate._waiting;
+	++gate._usage[tenant].waiting;
+	return true;
+}
+
+auto admission_gate::awaiter::await_resume() -> ticket {
+	if (!admitted) {
+		throw overloaded_exception{"too much work is queued, try again later"};
+	}
+	return ticket{gate, tenant};
+}
+
+void admission_gate::_release(tenant_id tenant) noexcept {
+	std::unique_lock lock{_mutex};
+
+	--_usage[tenant].in_flight;
+	_forget_if_idle(tenant);
+	if (size_t p = _lanes.pick([this](size_t lane) { return !_waiters[lane].empty(); }); p < priority_count) {
+		/* The slot goes straight to the waiter, _in_flight doesn't change */
+		awaiter* next = _waiters[p].pop();
+
+		--_waiting;
+		--_usage[next->tenant].waiting;
+		_admit(next->tenant, p);
+		next->admitted = true;
+		_resume(next);
+		return;
+	}
+	_in_flight.fetch_sub(1, std::memory_order_relaxed);
+}
+
+std::string to_string(std::span<const admission_gate::tenant_usage> usage) {
+	std::string ret;
+
+	for (const admission_gate::tenant_usage& u : usage) {
+		if (!ret.empty()) {
+			ret += "; ";
+		}
+		ret += std::format("tenant {}: {} in flight, {} waiting, {} admitted, {} refused", u.tenant, u.in_flight, u.waiting, u.admitted, u.refused);
+	}
+	return ret.empty() ? "idle" : ret;
+}
+
+}
@@ -0,0 +1,233 @@
+#ifndef MIMIRON_TOOLS_BACKPRESSURE_H_
+#define MIMIRON_TOOLS_BACKPRESSURE_H_
+
+#include <array>
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "exception.h"
+#include "tools/fair_queue.h"
+
+namespace mimiron {
+
+class thread_pool;
+
+/**
+ * What to do with work that arrives when a queue is full.
+ */
+enum class overflow_policy {
+	/* Wait for room, up to the waiting limit if there is one */
+	wait,
+	/* Fail right away */
+	reject,
+	/* Wait for room, and when the waiting limit is reached drop the lowest priority waiter to make room */
+	shed
+};
+
+overflow_policy parse_overflow_policy(std::string_view name);
+
+enum class priority : uint8_t {
+	background,
+	normal,
+	interactive
+};
+
+inline constexpr size_t priority_count = 3;
+
+/**
+ * Picks which priority to serve next: the highest one waiting, unless a lower one got less than its minimum share
+ * of what was recently served, so that background work keeps trickling through under interactive load.
+ */
+class lane_scheduler {
+public:
+	using shares = std::array<double, priority_count>;
+
+	static constexpr shares default_min_share = {0.10, 0.20, 0.0};
+
+	explicit lane_scheduler(shares min_share = default_min_share) noexcept : _min_share{min_share} {}
+
+	/**
+	 * @param waiting Whether a priority, given as its index, has anything waiting
+	 * @return Index of the priority to serve, priority_count if nothing is waiting
+	 */
+	template <typename Pred>
+	size_t pick(Pred&& waiting) const {
+		size_t highest = priority_count;
+
+		for (size_t p = priority_count; p-- > 0;) {
+			if (!waiting(p)) {
+				continue;
+			}
+			if (highest == priority_count) {
+				highest = p;
+			}
+			if (static_cast<double>(_served[p]) < _min_share[p] * static_cast<double>(_total)) {
+				return p;
+			}
+		}
+		return highest;
+	}
+
+	void served(size_t lane) noexcept {
+		++_served[lane];
+		/* Halve the counts now and then so that shares follow recent traffic */
+		if (++_total >= window) {
+			for (size_t& s : _served) {
+				s /= 2;
+			}
+			_total /= 2;
+		}
+	}
+
+private:
+	static constexpr size_t window = 256;
+
+	shares _min_share;
+	std::array<size_t, priority_count> _served{};
+	size_t _total = 0;
+};
+
+/**
+ * Thrown to work that was refused or shed because its queue is full.
+ */
+class overloaded_exception : public exception {
+public:
+	using exception::exception;
+};
+
+/**
+ * Bounds the amount of work in flight, and the number of submitters waiting for room.
+ *
+ * Waiters are let in by priority, lower priorities getting a minimum share of the slots, then round-robin between
+ * tenants by weight, then in order of arrival. They are resumed on the thread pool rather than inside whoever let them in.
+ */
+class admission_gate {
+	struct waiter;
+
+public:
+	/**
+	 * Held while the work is in flight, gives its slot to the next waiter when destroyed.
+	 */
+	class ticket {
+	public:
+		ticket() = default;
+		ticket(admission_gate& gate, tenant_id tenant) noexcept : _gate{&gate}, _tenant{tenant} {}
+		ticket(ticket&& other) noexcept : _gate{std::exchange(other._gate, nullptr)}, _tenant{other._tenant} {}
+		ticket& operator=(ticket&& other) noexcept;
+		~ticket();
+
+	private:
+		admission_gate* _gate = nullptr;
+		tenant_id _tenant = 0;
+	};
+
+	struct tenant_usage {
+		tenant_id tenant;
+		size_t in_flight;
+		size_t waiting;
+		/* Since the tenant last had nothing in flight or waiting */
+		uint64_t admitted;
+		uint64_t refused;
+	};
+
+	struct awaiter {
+		bool await_ready();
+		bool await_suspend(std::coroutine_handle<> handle);
+		ticket await_resume();
+
+		admission_gate& gate;
+		priority level;
+		tenant_id tenant;
+		std::coroutine_handle<> coroutine = {};
+		bool admitted = false;
+	};
+
+	/**
+	 * @param max_waiting Waiters allowed before the policy kicks in, 0 means unbounded. Ignored when rejecting, which never waits
+	 */
+	admission_gate(thread_pool& executor, size_t capacity, overflow_policy policy = overflow_policy::wait, size_t max_waiting = 0, lane_scheduler::shares min_share = lane_scheduler::default_min_share);
+
+	/**
+	 * Wait for a slot according to the policy, the awaited ticket must be kept until the work is done.
+	 *
+	 * @throws overloaded_exception if the work was refused, or shed while waiting
+	 */
+	[[nodiscard]] awaiter enter(priority level = priority::normal, tenant_id tenant = 0) noexcept {
+		return {*this, level, tenant};
+	}
+
+	/**
+	 * Share of the slots a tenant gets relative to others when they compete, 1 by default.
+	 */
+	void set_tenant_weight(tenant_id tenant, double weight);
+
+	/**
+	 * Slots a tenant that had nothing waiting can take in a row before yielding to others.
+	 */
+	void set_tenant_burst(size_t burst);
+
+	/**
+	 * Per-tenant counts, for the tenants that have something in flight or waiting.
+	 */
+	std::vector<tenant_usage> usage() const;
+
+	/**
+	 * Whether the gate is struggling to keep up: at least half of the waiting room is taken,
+	 * or every slot is taken when the waiting room is unbounded or there is none.
+	 */
+	bool overloaded() const noexcept {
+		if (_max_waiting == 0) {
+			return _in_flight.load(std::memory_order_relaxed) >= _capacity;
+		}
+		return _waiting.load(std::memory_order_relaxed) * 2 >= _max_waiting;
+	}
+
+	size_t in_flight() const noexcept {
+		return _in_flight.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct usage_counters {
+		size_t in_flight = 0;
+		size_t waiting = 0;
+		uint64_t admitted = 0;
+		uint64_t refused = 0;
+	};
+
+	bool _room_to_wait() const noexcept;
+	void _admit(tenant_id tenant, size_t lane);
+	void _forget_if_idle(tenant_id tenant) noexcept;
+	void _resume(awaiter* waiter) noexcept;
+	void _release(tenant_id tenant) noexcept;
+
+	thread_pool& _executor;
+	size_t _capacity;
+	overflow_policy _policy;
+	size_t _max_waiting;
+	mutable std::mutex _mutex;
+	std::atomic<size_t> _in_flight = 0;
+	/* Only modified with the mutex held */
+	std::atomic<size_t> _waiting = 0;
+	std::array<fair_queue<awaiter*>, priority_count> _waiters;
+	lane_scheduler _lanes;
+	std::unordered_map<tenant_id, double> _weights;
+	/* Dropped once a tenant has nothing in flight or waiting, so that the guilds that ever made a request don't pile up */
+	std::unordered_map<tenant_id, usage_counters> _usage;
+};
+
+/**
+ * Like "tenant 0: 2 in flight, 5 waiting, 120 admitted, 3 refused; tenant 1: ...", for logs.
+ */
+std::string to_string(std::span<const admission_gate::tenant_usage> usage);
+
+}
+
+#endif /* MIMIRON_TOOLS_BACKPRESSURE_H_ */
@@ -105,15 +105,19 @@ public:
 	}
 
 	cached_resource &operator=(const cached_resource &other) noexcept {
-		ptr = other.ptr;
-		if (ptr) {
-			ptr->increment();
+		if (other.ptr) {
+			other.ptr->increment();
 		}
+		release();
+		ptr = other.ptr;
 		return *this;
 	}
 
 	cached_resource &operator=(cached_resource &&other) noexcept {
-		ptr = std::exchange(other.ptr, nullptr);
+		if (this != &other) {
+			release();
+			ptr = std::exchange(other.ptr, nullptr);
+		}
 		return *this;
 	}
 
@@ -145,12 +149,6 @@ public:
 		return &ptr->operator*();
 	}
 
-	Key &key() noexcept {
-		assert(ptr);
-
-		return ptr->operator*().first;
-	}
-
 	const Key &key() const noexcept {
 		assert(ptr);
 
@@ -311,6 +309,46 @@ public:
 		return {_emplace(std::forward<T>(key), hashed, std::forward<Args>(args)...), true};
 	}
 
+	/**
+	 * Insert a value, or replace the existing one. References to the previous value stay valid but it can't be found anymore.
+	 */
+	template <typename T, typename... Args>
+	cached_resource<Key, Value> replace(T&& key, Args&&... args) noexcept(nothrow_lookup<T> && nothrow_emplace<Args...>) {
+		size_t hashed = hash(key);
+		std::lock_guard lock{mutex};
+
+		_erase_hash(key, hashed);
+		return _emplace(std::forward<T>(key), hashed, std::forward<Args>(args)...);
+	}
+
+	/**
+	 * Replace the value with one computed from the current one, which `function` gets a pointer to, nullptr if there is none.
+	 * Runs under the cache's lock so that no other change to the key can land in between, the function must not touch the cache.
+	 * Like with replace, references to the previous value stay valid.
+	 */
+	template <typename T, typename Func>
+	requires (std::is_invocable_r_v<Value, Func, Value const*>)
+	cached_resource<Key, Value> update(T&& key, Func&& function) {
+		size_t hashed = hash(key);
+		std::lock_guard lock{mutex};
+		cached_resource<Key, Value> current = _find_hash(key, hashed);
+		Value updated = std::invoke(function, current ? &current.value() : static_cast<Value const*>(nullptr));
+
+		_erase_hash(key, hashed);
+		return _emplace(std::forward<T>(key), hashed, std::move(updated));
+	}
+
+	/**
+	 * Returns whether the key was found. Like with replace, references to the erased value stay valid.
+	 */
+	template <typename T>
+	bool erase(const T& key) noexcept(nothrow_lookup<T>) {
+		size_t hashed = hash(key);
+		std::lock_guard lock{mutex};
+
+		return _erase_hash(key, hashed);
+	}
+
 	template <typename T>
 	requires (std::is_constructible_v<Key, T> && std::is_default_constructible_v<Value>)
 	cached_resource<Key, Value> operator[](T&& key) noexcept (nothrow_lookup<T> && nothrow_emplace<T>) {
@@ -336,17 +374,35 @@ private:
 		if (_buckets.empty())
 			return {};
 #endif
+		if (node* n = _find_node(key, hash); n) {
+			return n->my_ref;
+		}
+		return {};
+	}
+
+	/* Keep looking past nodes with the same hash: another key, or an erased value still referenced somewhere */
+	template <typename T>
+	node* _find_node(const T& key, size_t hash) noexcept(nothrow_equal<T>) {
 		for (bucket &b : _buckets) {
-			if (auto it = std::ranges::find(b, hash, &node::hash); it != b.end()) {
-				if (it->my_ref) { // use the reference here because that means the resource can't be destroyed in-between
-					const auto& [elem_key, _] = *(it->my_ref);
-					if (elem_key == key) {
-						return it->my_ref;
+			for (node &n : b) {
+				if (n.hash == hash && n.my_ref) { // use the reference here because that means the resource can't be destroyed in-between
+					if (n.my_ref.key() == key) {
+						return &n;
 					}
 				}
 			}
 		}
-		return {};
+		return nullptr;
+	}
+
+	template <typename T>
+	bool _erase_hash(const T& key, size_t hash) noexcept(nothrow_equal<T>) {
+		if (node* n = _find_node(key, hash); n) {
+			/* The slot is reused once the last outside reference is gone */
+			n->my_ref.release();
+			return true;
+		}
+		return false;
 	}
 
 	template <typename T>
@@ -356,12 +412,9 @@ private:
 			return {};
 #endif
 		for (const bucket &b : _buckets) {
-			if (auto it = std::ranges::find(b, hash, &node::hash); it != b.end()) {
-				if (it->my_ref) { // use the reference here because that means the resource can't be destroyed in-between
-					const auto& [elem_key, _] = *(it->my_ref);
-					if (elem_key == key) {
-						return it->my_ref;
-					}
+			for (const node &n : b) {
+				if (n.hash == hash && n.my_ref && n.my_ref.key() == key) {
+					return n.my_ref;
 				}
 			}
 		}
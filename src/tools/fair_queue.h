@@ -0,0 +1,138 @@
+#ifndef MIMIRON_TOOLS_FAIR_QUEUE_H_
+#define MIMIRON_TOOLS_FAIR_QUEUE_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+
+namespace mimiron {
+
+/**
+ * Who work is done for, so that capacity can be shared between them. 0 is the bot itself.
+ */
+using tenant_id = uint64_t;
+
+/**
+ * Queue shared by tenants, served by deficit round-robin: each tenant gets turns in proportion to its weight
+ * however much it has queued, and in order of arrival within a tenant.
+ *
+ * A tenant that had nothing queued starts with `burst` turns saved up, so light users get through a short burst
+ * without waiting behind heavy ones. Not thread-safe.
+ */
+template <typename T>
+class fair_queue {
+public:
+	explicit fair_queue(size_t burst = 1) noexcept : _burst{static_cast<double>(std::max<size_t>(burst, 1))} {}
+
+	void set_burst(size_t burst) noexcept {
+		_burst = static_cast<double>(std::max<size_t>(burst, 1));
+	}
+
+	bool empty() const noexcept {
+		return _ring.empty();
+	}
+
+	size_t size() const noexcept {
+		return _size;
+	}
+
+	/**
+	 * @param weight Share of the turns relative to other tenants, only taken when the tenant had nothing queued
+	 */
+	void push(tenant_id tenant, T value, double weight = 1.0) {
+		auto [it, inserted] = _tenants.try_emplace(tenant);
+		state& s = it->second;
+
+		if (inserted) {
+			s.weight = weight > 0.0 ? weight : 1.0;
+			s.credit = _burst;
+			_ring.push_back(tenant);
+		}
+		s.items.push_back(std::move(value));
+		++_size;
+	}
+
+	/**
+	 * Take the next item, the queue must not be empty.
+	 */
+	T pop() {
+		assert(!empty());
+		for (;;) {
+			state& s = _tenants.at(_ring.front());
+
+			if (s.credit >= 1.0) {
+				s.credit -= 1.0;
+				return _take_front(s);
+			}
+			/* Its turns are used up for this round, it gets its quantum for the next one */
+			s.credit = std::min(s.credit + s.weight, std::max(_burst, s.weight));
+			_ring.push_back(_ring.front());
+			_ring.pop_front();
+		}
+	}
+
+	size_t queued(tenant_id tenant) const {
+		auto it = _tenants.find(tenant);
+
+		return it == _tenants.end() ? 0 : it->second.items.size();
+	}
+
+	/**
+	 * Take the newest item of the tenant with the most queued, to make room at their expense.
+	 *
+	 * @param more_than Only if that tenant has more than this queued
+	 */
+	std::optional<T> pop_heaviest(size_t more_than = 0) {
+		if (empty()) {
+			return std::nullopt;
+		}
+		auto heaviest = std::ranges::max_element(_ring, {}, [this](tenant_id t) { return _tenants.at(t).items.size(); });
+		tenant_id tenant = *heaviest;
+		state& s = _tenants.at(tenant);
+
+		if (s.items.size() <= more_than) {
+			return std::nullopt;
+		}
+		T value = std::move(s.items.back());
+
+		s.items.pop_back();
+		--_size;
+		if (s.items.empty()) {
+			_ring.erase(heaviest);
+			_tenants.erase(tenant);
+		}
+		return value;
+	}
+
+private:
+	struct state {
+		std::deque<T> items;
+		double weight = 1.0;
+		double credit = 0.0;
+	};
+
+	T _take_front(state& s) {
+		T value = std::move(s.items.front());
+
+		s.items.pop_front();
+		--_size;
+		if (s.items.empty()) {
+			/* Forgotten once idle, it comes back with a fresh burst */
+			_tenants.erase(_ring.front());
+			_ring.pop_front();
+		}
+		return value;
+	}
+
+	double _burst;
+	size_t _size = 0;
+	std::deque<tenant_id> _ring;
+	std::unordered_map<tenant_id, state> _tenants;
+};
+
+}
+
+#endif /* MIMIRON_TOOLS_FAIR_QUEUE_H_ */
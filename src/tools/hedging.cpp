@@ -0,0 +1,67 @@
+#include "tools/hedging.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace mimiron {
+
+void latency_window::record(app_duration latency) noexcept {
+	_samples[_next] = latency;
+	_next = (_next + 1) % capacity;
+	_count = std::min(_count + 1, capacity);
+}
+
+std::optional<app_duration> latency_window::percentile(double p) const {
+	if (_count < min_samples) {
+		return std::nullopt;
+	}
+	std::array<app_duration, capacity> sorted = _samples;
+	auto end = sorted.begin() + static_cast<std::ptrdiff_t>(_count);
+	auto rank = std::clamp(static_cast<size_t>(std::ceil(p * static_cast<double>(_count))), size_t{1}, _count);
+	auto nth = sorted.begin() + static_cast<std::ptrdiff_t>(rank - 1);
+
+	std::nth_element(sorted.begin(), nth, end);
+	return *nth;
+}
+
+std::optional<app_duration> hedging_policy::on_request(const std::string& endpoint) {
+	if (_settings.max_ratio <= 0.0) {
+		return std::nullopt;
+	}
+	std::unique_lock lock{_mutex};
+
+	_credit = std::min(max_credit, _credit + _settings.max_ratio);
+	if (auto it = _windows.find(endpoint); it != _windows.end()) {
+		if (auto threshold = it->second.percentile(_settings.percentile); threshold) {
+			return std::max(*threshold, _settings.min_delay);
+		}
+	}
+	return std::nullopt;
+}
+
+bool hedging_policy::try_hedge() noexcept {
+	std::unique_lock lock{_mutex};
+
+	if (_credit < 1.0) {
+		return false;
+	}
+	_credit -= 1.0;
+	return true;
+}
+
+void hedging_policy::refund() noexcept {
+	std::unique_lock lock{_mutex};
+
+	_credit = std::min(max_credit, _credit + 1.0);
+}
+
+void hedging_policy::record(const std::string& endpoint, app_duration latency) {
+	if (_settings.max_ratio <= 0.0) {
+		return;
+	}
+	std::unique_lock lock{_mutex};
+
+	_windows[endpoint].record(latency);
+}
+
+}
@@ -0,0 +1,86 @@
+#ifndef MIMIRON_TOOLS_HEDGING_H_
+#define MIMIRON_TOOLS_HEDGING_H_
+
+#include <array>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "common.h"
+
+namespace mimiron {
+
+/**
+ * Latencies of the last responses from one endpoint.
+ */
+class latency_window {
+public:
+	static constexpr size_t capacity = 128;
+	/* Below this many samples a percentile is mostly noise */
+	static constexpr size_t min_samples = 20;
+
+	void record(app_duration latency) noexcept;
+
+	/**
+	 * @param p Between 0 and 1
+	 * @return nullopt until there are enough samples
+	 */
+	std::optional<app_duration> percentile(double p) const;
+
+private:
+	std::array<app_duration, capacity> _samples{};
+	size_t _next = 0;
+	size_t _count = 0;
+};
+
+/**
+ * Decides when a request gets a duplicate: once it has waited longer than most responses from its endpoint take,
+ * and only while duplicates stay under a fraction of the requests sent.
+ */
+class hedging_policy {
+public:
+	struct settings {
+		/* Hedges allowed per request sent, hedging is off at 0 */
+		double max_ratio = 0.0;
+		/* Percentile of the endpoint's latency a request must exceed to be hedged */
+		double percentile = 0.95;
+		/* Never hedge sooner than this, fast endpoints would be doubled on noise */
+		app_duration min_delay = 50ms;
+	};
+
+	hedging_policy() = default;
+	explicit hedging_policy(settings s) noexcept : _settings{s} {}
+
+	/**
+	 * Count a request towards the budget.
+	 *
+	 * @return How long to wait for its response before hedging, nullopt if it shouldn't be
+	 */
+	std::optional<app_duration> on_request(const std::string& endpoint);
+
+	/**
+	 * Spend the budget on a hedge, false if it is used up.
+	 */
+	bool try_hedge() noexcept;
+
+	/**
+	 * Give back a hedge that could not be sent.
+	 */
+	void refund() noexcept;
+
+	void record(const std::string& endpoint, app_duration latency);
+
+private:
+	/* Hedges that can be sent in a row after a quiet period */
+	static constexpr double max_credit = 10.0;
+
+	settings _settings;
+	std::mutex _mutex;
+	std::unordered_map<std::string, latency_window> _windows;
+	double _credit = 0.0;
+};
+
+}
+
+#endif /* MIMIRON_TOOLS_HEDGING_H_ */
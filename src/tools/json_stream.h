@@ -0,0 +1,612 @@
+#ifndef MIMIRON_TOOLS_JSON_STREAM_H_
+#define MIMIRON_TOOLS_JSON_STREAM_H_
+
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <boost/pfr.hpp>
+
+#include <dpp/exception.h>
+#include <dpp/json.h>
+
+#include "exception.h"
+#include "tools/perfect_hash.h"
+#include "tools/tools.h"
+
+namespace mimiron {
+
+namespace detail::json_stream {
+
+class reader;
+struct sink;
+struct frame;
+
+/**
+ * What to do with a value depending on its json type, for one C++ type.
+ */
+struct sink_handlers {
+	void (*on_null)(reader&, const sink&);
+	void (*on_bool)(reader&, const sink&, bool);
+	void (*on_integer)(reader&, const sink&, int64_t);
+	void (*on_unsigned)(reader&, const sink&, uint64_t);
+	void (*on_float)(reader&, const sink&, double);
+	void (*on_string)(reader&, const sink&, std::string&);
+	void (*on_object)(reader&, const sink&);
+	void (*on_array)(reader&, const sink&);
+	/* For values that were captured as json */
+	void (*on_json)(const sink&, nlohmann::json&&);
+};
+
+/**
+ * Where the next value goes. Without handlers the value is skipped.
+ */
+struct sink {
+	const sink_handlers* handlers = nullptr;
+	void* target = nullptr;
+	/* For errors, the field the value belongs to */
+	std::string_view field;
+};
+
+/**
+ * What to do with the members of an object or the elements of an array.
+ */
+struct frame_handlers {
+	/* Sink for the member named `key`, or for the next element */
+	sink (*next)(frame&, std::string_view key);
+	/* Called at the end of the object or array */
+	void (*finish)(const frame&);
+};
+
+struct frame {
+	enum class kind : uint8_t {
+		/* Members or elements go to a C++ object */
+		fill,
+		/* Unknown subtree */
+		skip,
+		/* Subtree kept as json, for types that parse themselves */
+		capture
+	};
+
+	kind type;
+	/* Whether this is a json object, whose members come after a key */
+	bool keyed = false;
+	sink container;
+	const frame_handlers* handlers = nullptr;
+	/* Members seen, by position in the aggregate */
+	uint64_t seen = 0;
+	/* Nested objects and arrays, when skipping */
+	size_t depth = 0;
+	/* Sink for the member whose key was just read */
+	sink pending;
+};
+
+/**
+ * SAX handler filling C++ objects as the json is read, without building a DOM of it.
+ */
+class reader : public nlohmann::json_sax<nlohmann::json> {
+public:
+	explicit reader(sink root) : _root{root} {}
+
+	void push(frame f) {
+		_stack.push_back(f);
+	}
+
+	void capture(const sink& target, nlohmann::json container) {
+		_captured = std::move(container);
+		_capture_path.assign(1, &_captured);
+		_stack.push_back(frame{.type = frame::kind::capture, .container = target});
+	}
+
+	bool null() override;
+	bool boolean(bool val) override;
+	bool number_integer(number_integer_t val) override;
+	bool number_unsigned(number_unsigned_t val) override;
+	bool number_float(number_float_t val, const string_t& s) override;
+	bool string(string_t& val) override;
+	bool binary(binary_t& val) override;
+	bool start_object(std::size_t elements) override;
+	bool key(string_t& val) override;
+	bool end_object() override;
+	bool start_array(std::size_t elements) override;
+	bool end_array() override;
+	bool parse_error(std::size_t position, const std::string& last_token, const nlohmann::detail::exception& ex) override;
+
+private:
+	/**
+	 * Sink for the value being read, once the top frame is filling something.
+	 */
+	sink _next();
+
+	/**
+	 * Hand a scalar to `deliver` with its sink, unless the top frame skips or captures it.
+	 */
+	template <typename V, typename Fn>
+	bool _value(V& val, Fn&& deliver);
+
+	bool _open(nlohmann::json&& container);
+	bool _close();
+
+	sink _root;
+	bool _root_used = false;
+	std::vector<frame> _stack;
+	nlohmann::json _captured;
+	std::vector<nlohmann::json*> _capture_path;
+	std::string _capture_key;
+};
+
+template <typename T>
+inline constexpr bool is_vector = is_specialization_v<T, std::vector>;
+
+template <typename T>
+concept parses_itself = requires (const nlohmann::json& j) {
+	{ T::from_json(j) } -> std::convertible_to<T>;
+};
+
+template <typename T>
+concept scalar = std::is_arithmetic_v<T> || std::is_same_v<T, std::string>;
+
+/* Aggregates are filled member by member, anything else not listed here goes through nlohmann */
+template <typename T>
+concept structure = std::is_aggregate_v<T> && !parses_itself<T> && !is_vector<T> && !is_optional<T>;
+
+template <typename T>
+concept captured = !scalar<T> && !is_vector<T> && !is_optional<T> && !structure<T>;
+
+template <typename T>
+const sink_handlers* handlers_for() noexcept;
+
+template <typename T>
+sink sink_for(T& target, std::string_view field) {
+	return {handlers_for<T>(), &target, field};
+}
+
+template <typename T>
+T& target_of(const sink& s) {
+	return *static_cast<T*>(s.target);
+}
+
+[[noreturn]] inline void unexpected(const sink& s, std::string_view what) {
+	throw exception{std::format("failed to parse field `{}`: unexpected {}", s.field, what)};
+}
+
+template <typename T>
+void from_json(const sink& s, nlohmann::json&& j) {
+	try {
+		if constexpr (parses_itself<T>) {
+			target_of<T>(s) = T::from_json(j);
+		} else {
+			target_of<T>(s) = j.get<T>();
+		}
+	} catch (const nlohmann::detail::exception &e) {
+		throw exception{std::format("failed to parse field `{}`: {}", s.field, e.what())};
+	}
+}
+
+/**
+ * Numbers and booleans, which only differ in the type they arrive as.
+ */
+template <typename T, typename V>
+void on_primitive(reader& r, const sink& s, V value, std::string_view what) {
+	if constexpr (is_optional<T>) {
+		auto& opt = target_of<T>(s);
+
+		opt.emplace();
+		on_primitive<typename T::value_type>(r, sink_for(*opt, s.field), value, what);
+	} else if constexpr (std::is_same_v<T, bool>) {
+		if constexpr (std::is_same_v<V, bool>) {
+			target_of<T>(s) = value;
+		} else {
+			unexpected(s, what);
+		}
+	} else if constexpr (std::is_arithmetic_v<T>) {
+		target_of<T>(s) = static_cast<T>(value);
+	} else if constexpr (std::is_same_v<T, std::string>) {
+		if constexpr (std::is_same_v<V, bool>) {
+			unexpected(s, what);
+		} else if constexpr (std::is_floating_point_v<V>) {
+			target_of<T>(s) = std::to_string(static_cast<long double>(value));
+		} else {
+			target_of<T>(s) = std::to_string(value);
+		}
+	} else if constexpr (captured<T>) {
+		from_json<T>(s, nlohmann::json(value));
+	} else {
+		unexpected(s, what);
+	}
+}
+
+template <typename T>
+void on_null(reader& r, const sink& s) {
+	if constexpr (is_optional<T>) {
+		target_of<T>(s) = std::nullopt;
+	} else if constexpr (captured<T>) {
+		from_json<T>(s, nlohmann::json(nullptr));
+	} else {
+		unexpected(s, "null");
+	}
+}
+
+template <typename T>
+void on_bool(reader& r, const sink& s, bool value) {
+	on_primitive<T>(r, s, value, "boolean");
+}
+
+template <typename T>
+void on_integer(reader& r, const sink& s, int64_t value) {
+	on_primitive<T>(r, s, value, "number");
+}
+
+template <typename T>
+void on_unsigned(reader& r, const sink& s, uint64_t value) {
+	on_primitive<T>(r, s, value, "number");
+}
+
+template <typename T>
+void on_float(reader& r, const sink& s, double value) {
+	on_primitive<T>(r, s, value, "number");
+}
+
+template <typename T>
+void on_string(reader& r, const sink& s, std::string& value) {
+	if constexpr (is_optional<T>) {
+		auto& opt = target_of<T>(s);
+
+		opt.emplace();
+		on_string<typename T::value_type>(r, sink_for(*opt, s.field), value);
+	} else if constexpr (std::is_same_v<T, bool>) {
+		target_of<T>(s) = value == "true";
+	} else if constexpr (std::is_arithmetic_v<T>) {
+		auto [end, err] = std::from_chars(value.data(), value.data() + value.size(), target_of<T>(s));
+
+		/* The whole string has to be the number, "12abc" is not 12 */
+		if (err != std::errc{} || end != value.data() + value.size()) {
+			throw dpp::parse_exception{std::format("failed to parse number in string \"{}\" for field `{}`", value, s.field)};
+		}
+	} else if constexpr (std::is_same_v<T, std::string>) {
+		target_of<T>(s) = std::move(value);
+	} else if constexpr (captured<T>) {
+		from_json<T>(s, nlohmann::json(std::move(value)));
+	} else {
+		unexpected(s, "string");
+	}
+}
+
+template <typename T>
+struct structure_frame {
+	static constexpr size_t size = boost::pfr::tuple_size_v<T>;
+
+	static_assert(size <= 64, "members seen are kept on 64 bits");
+
+	static constexpr auto names = []<size_t... Ns>(std::index_sequence<Ns...>) {
+		return std::array<std::string_view, size>{boost::pfr::get_name<Ns, T>()...};
+	}(std::make_index_sequence<size>{});
+
+	static constexpr perfect_hash<size> lookup{names};
+
+	static constexpr auto members = []<size_t... Ns>(std::index_sequence<Ns...>) {
+		return std::array<sink (*)(T&), size>{
+			[](T& value) { return sink_for(boost::pfr::get<Ns>(value), names[Ns]); }...
+		};
+	}(std::make_index_sequence<size>{});
+
+	static constexpr auto optional = []<size_t... Ns>(std::index_sequence<Ns...>) {
+		return std::array<bool, size>{is_optional<boost::pfr::tuple_element_t<Ns, T>>...};
+	}(std::make_index_sequence<size>{});
+
+	static sink next(frame& f, std::string_view key) {
+		size_t index = lookup.find(key);
+
+		if (index == lookup.npos) {
+			return {};
+		}
+		f.seen |= uint64_t{1} << index;
+		return members[index](target_of<T>(f.container));
+	}
+
+	static void finish(const frame& f) {
+		for (size_t i = 0; i < size; ++i) {
+			if (!(f.seen & (uint64_t{1} << i)) && !optional[i]) {
+				throw dpp::parse_exception{std::format("non-optional field `{}` is not present", names[i])};
+			}
+		}
+	}
+
+	static constexpr frame_handlers handlers{&next, &finish};
+};
+
+/* The values of an object are taken as elements too, as parse_json does */
+template <typename T>
+struct vector_frame {
+	static sink next(frame& f, std::string_view) {
+		return sink_for(target_of<T>(f.container).emplace_back(), f.container.field);
+	}
+
+	static void finish(const frame&) {
+	}
+
+	static constexpr frame_handlers handlers{&next, &finish};
+};
+
+template <typename T>
+void on_container(reader& r, const sink& s, bool keyed) {
+	if constexpr (is_optional<T>) {
+		auto& opt = target_of<T>(s);
+
+		opt.emplace();
+		on_container<typename T::value_type>(r, sink_for(*opt, s.field), keyed);
+	} else if constexpr (structure<T>) {
+		if (!keyed) {
+			unexpected(s, "array");
+		}
+		r.push(frame{.type = frame::kind::fill, .keyed = true, .container = s, .handlers = &structure_frame<T>::handlers});
+	} else if constexpr (is_vector<T>) {
+		r.push(frame{.type = frame::kind::fill, .keyed = keyed, .container = s, .handlers = &vector_frame<T>::handlers});
+	} else if constexpr (captured<T>) {
+		r.capture(s, keyed ? nlohmann::json::object() : nlohmann::json::array());
+	} else {
+		unexpected(s, keyed ? "object" : "array");
+	}
+}
+
+template <typename T>
+void on_object(reader& r, const sink& s) {
+	on_container<T>(r, s, true);
+}
+
+template <typename T>
+void on_array(reader& r, const sink& s) {
+	on_container<T>(r, s, false);
+}
+
+template <typename T>
+void on_json(const sink& s, nlohmann::json&& j) {
+	if constexpr (captured<T>) {
+		from_json<T>(s, std::move(j));
+	}
+}
+
+template <typename T>
+const sink_handlers* handlers_for() noexcept {
+	static constexpr sink_handlers handlers{
+		&on_null<T>,
+		&on_bool<T>,
+		&on_integer<T>,
+		&on_unsigned<T>,
+		&on_float<T>,
+		&on_string<T>,
+		&on_object<T>,
+		&on_array<T>,
+		&on_json<T>
+	};
+
+	return &handlers;
+}
+
+/**
+ * Root of a document whose value is in one of its members, the others are skipped.
+ */
+template <typename T>
+struct member_frame {
+	static sink next(frame& f, std::string_view key) {
+		if (key != f.container.field) {
+			return {};
+		}
+		f.seen = 1;
+		return f.container;
+	}
+
+	static void finish(const frame& f) {
+		if (!f.seen) {
+			throw dpp::parse_exception{std::format("non-optional field `{}` is not present", f.container.field)};
+		}
+	}
+
+	static constexpr frame_handlers handlers{&next, &finish};
+
+	static void on_object(reader& r, const sink& s) {
+		r.push(frame{.type = frame::kind::fill, .keyed = true, .container = {handlers_for<T>(), s.target, s.field}, .handlers = &handlers});
+	}
+
+	static void on_other(reader&, const sink& s) {
+		unexpected(s, "value at the top level");
+	}
+
+	static constexpr sink_handlers root{
+		[](reader& r, const sink& s) { on_other(r, s); },
+		[](reader& r, const sink& s, bool) { on_other(r, s); },
+		[](reader& r, const sink& s, int64_t) { on_other(r, s); },
+		[](reader& r, const sink& s, uint64_t) { on_other(r, s); },
+		[](reader& r, const sink& s, double) { on_other(r, s); },
+		[](reader& r, const sink& s, std::string&) { on_other(r, s); },
+		&on_object,
+		&on_other,
+		[](const sink&, nlohmann::json&&) {}
+	};
+};
+
+inline sink reader::_next() {
+	if (_stack.empty()) {
+		if (_root_used) {
+			throw dpp::parse_exception{"more than one value at the top level"};
+		}
+		_root_used = true;
+		return _root;
+	}
+	frame& top = _stack.back();
+
+	return top.keyed ? std::exchange(top.pending, {}) : top.handlers->next(top, {});
+}
+
+template <typename V, typename Fn>
+bool reader::_value(V& val, Fn&& deliver) {
+	if (!_stack.empty() && _stack.back().type != frame::kind::fill) {
+		if (_stack.back().type == frame::kind::capture) {
+			nlohmann::json& container = *_capture_path.back();
+
+			if (container.is_object()) {
+				container[_capture_key] = std::move(val);
+			} else {
+				container.emplace_back(std::move(val));
+			}
+		}
+		return true;
+	}
+	if (sink s = _next(); s.handlers != nullptr) {
+		deliver(s);
+	}
+	return true;
+}
+
+inline bool reader::_open(nlohmann::json&& container) {
+	if (!_stack.empty()) {
+		frame& top = _stack.back();
+
+		if (top.type == frame::kind::skip) {
+			++top.depth;
+			return true;
+		}
+		if (top.type == frame::kind::capture) {
+			nlohmann::json& parent = *_capture_path.back();
+			nlohmann::json& child = parent.is_object() ? (parent[_capture_key] = std::move(container)) : parent.emplace_back(std::move(container));
+
+			_capture_path.push_back(&child);
+			return true;
+		}
+	}
+	sink s = _next();
+
+	if (s.handlers == nullptr) {
+		_stack.push_back(frame{.type = frame::kind::skip, .depth = 1});
+	} else if (container.is_object()) {
+		s.handlers->on_object(*this, s);
+	} else {
+		s.handlers->on_array(*this, s);
+	}
+	return true;
+}
+
+inline bool reader::_close() {
+	frame& top = _stack.back();
+
+	switch (top.type) {
+		case frame::kind::skip:
+			if (--top.depth == 0) {
+				_stack.pop_back();
+			}
+			break;
+		case frame::kind::capture:
+			_capture_path.pop_back();
+			if (_capture_path.empty()) {
+				sink target = top.container;
+
+				_stack.pop_back();
+				target.handlers->on_json(target, std::move(_captured));
+			}
+			break;
+		case frame::kind::fill:
+			top.handlers->finish(top);
+			_stack.pop_back();
+			break;
+	}
+	return true;
+}
+
+inline bool reader::null() {
+	std::nullptr_t val = nullptr;
+
+	return _value(val, [this](const sink& s) { s.handlers->on_null(*this, s); });
+}
+
+inline bool reader::boolean(bool val) {
+	return _value(val, [&](const sink& s) { s.handlers->on_bool(*this, s, val); });
+}
+
+inline bool reader::number_integer(number_integer_t val) {
+	return _value(val, [&](const sink& s) { s.handlers->on_integer(*this, s, val); });
+}
+
+inline bool reader::number_unsigned(number_unsigned_t val) {
+	return _value(val, [&](const sink& s) { s.handlers->on_unsigned(*this, s, val); });
+}
+
+inline bool reader::number_float(number_float_t val, const string_t&) {
+	return _value(val, [&](const sink& s) { s.handlers->on_float(*this, s, val); });
+}
+
+inline bool reader::string(string_t& val) {
+	return _value(val, [&](const sink& s) { s.handlers->on_string(*this, s, val); });
+}
+
+inline bool reader::binary(binary_t&) {
+	throw dpp::parse_exception{"unexpected binary value"};
+}
+
+inline bool reader::start_object(std::size_t) {
+	return _open(nlohmann::json::object());
+}
+
+inline bool reader::key(string_t& val) {
+	frame& top = _stack.back();
+
+	switch (top.type) {
+		case frame::kind::capture:
+			_capture_key = std::move(val);
+			break;
+		case frame::kind::fill:
+			top.pending = top.handlers->next(top, val);
+			break;
+		default:
+			break;
+	}
+	return true;
+}
+
+inline bool reader::end_object() {
+	return _close();
+}
+
+inline bool reader::start_array(std::size_t) {
+	return _open(nlohmann::json::array());
+}
+
+inline bool reader::end_array() {
+	return _close();
+}
+
+inline bool reader::parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& ex) {
+	throw dpp::parse_exception{ex.what()};
+}
+
+}
+
+/**
+ * Parse json straight into a T as it is read, without building the document in memory. Members of the json
+ * that T doesn't have are skipped, types with a from_json only get their own subtree as json.
+ *
+ * @param field Member of the top-level object to parse instead of the whole document
+ */
+template <typename T>
+T parse_json_stream(std::span<const std::byte> bytes, const char* field = nullptr) {
+	using namespace detail::json_stream;
+
+	T value{};
+	sink root = field == nullptr ? sink_for(value, "") : sink{&member_frame<T>::root, &value, field};
+	reader r{root};
+	auto begin = reinterpret_cast<const char*>(bytes.data());
+
+	nlohmann::json::sax_parse(begin, begin + bytes.size(), &r);
+	return value;
+}
+
+}
+
+#endif /* MIMIRON_TOOLS_JSON_STREAM_H_ */
@@ -11,7 +11,7 @@
 #include <dpp/json.h>
 
 #include "exception.h"
-#include "localized_string.h"
+#include "wow/api/localized_string.h"
 
 namespace mimiron {
 
@@ -58,7 +58,7 @@ constexpr inline auto parse_one = [](const nlohmann::json& j, T& value) {
 				if (it->is_string()) {
 					std::string val = *it;
 					auto [end, err] = std::from_chars(val.data(), val.data() + val.size(), boost::pfr::get<N>(value));
-					if (err != std::errc{}) {
+					if (err != std::errc{} || end != val.data() + val.size()) {
 						throw dpp::parse_exception{std::format("failed to parse number in string \"{}\" for field `{}`", val, name)};
 					}
 					return;
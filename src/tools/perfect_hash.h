@@ -0,0 +1,84 @@
+#ifndef MIMIRON_TOOLS_PERFECT_HASH_H_
+#define MIMIRON_TOOLS_PERFECT_HASH_H_
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <string_view>
+
+namespace mimiron {
+
+/**
+ * Perfect hash of a fixed set of strings, built at compile time: every key has a slot of its own,
+ * so a lookup is one hash and one comparison.
+ */
+template <size_t N>
+class perfect_hash {
+public:
+	static_assert(N < 255, "slots are stored on a byte");
+
+	/* Twice the keys, so that a seed that separates them all is found in a few tries */
+	static constexpr size_t table_size = std::bit_ceil(std::max<size_t>(N * 2, 1));
+	static constexpr size_t npos = N;
+
+	consteval explicit perfect_hash(const std::array<std::string_view, N>& keys) : _keys{keys} {
+		for (size_t i = 0; i < N; ++i) {
+			for (size_t j = i + 1; j < N; ++j) {
+				if (_keys[i] == _keys[j]) {
+					throw "duplicate key";
+				}
+			}
+		}
+		for (uint32_t seed = fnv_basis; !_try_seed(seed); ++seed) {
+		}
+	}
+
+	/**
+	 * Position of `key` among the keys, npos if it isn't one.
+	 */
+	constexpr size_t find(std::string_view key) const noexcept {
+		size_t index = _slots[_hash(key, _seed)];
+
+		return index != npos && _keys[index] == key ? index : npos;
+	}
+
+private:
+	static constexpr uint32_t fnv_basis = 2166136261u;
+	static constexpr uint32_t fnv_prime = 16777619u;
+
+	/* FNV-1a, starting from the seed instead of the usual basis */
+	static constexpr size_t _hash(std::string_view key, uint32_t seed) noexcept {
+		uint32_t h = seed;
+
+		for (char c : key) {
+			h = (h ^ static_cast<uint8_t>(c)) * fnv_prime;
+		}
+		return (h >> 8) & (table_size - 1);
+	}
+
+	consteval bool _try_seed(uint32_t seed) {
+		std::array<uint8_t, table_size> slots;
+
+		slots.fill(static_cast<uint8_t>(npos));
+		for (size_t i = 0; i < N; ++i) {
+			size_t slot = _hash(_keys[i], seed);
+
+			if (slots[slot] != npos) {
+				return false;
+			}
+			slots[slot] = static_cast<uint8_t>(i);
+		}
+		_seed = seed;
+		_slots = slots;
+		return true;
+	}
+
+	std::array<std::string_view, N> _keys;
+	uint32_t _seed = fnv_basis;
+	std::array<uint8_t, table_size> _slots{};
+};
+
+}
+
+#endif /* MIMIRON_TOOLS_PERFECT_HASH_H_ */
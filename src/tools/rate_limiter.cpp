@@ -0,0 +1,216 @@
+#include "tools/rate_limiter.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace mimiron {
+
+rate_limiter::rate_limiter(timer_wheel& timers, std::initializer_list<limit> limits, lane_scheduler::shares min_share) :
+	_timers{timers},
+	_lanes{min_share}
+{
+	_self->limiter = this;
+	_buckets.reserve(limits.size());
+	for (const limit& l : limits) {
+		double capacity = static_cast<double>(std::max<size_t>(l.requests, 1));
+
+		_buckets.push_back({
+			.capacity = capacity,
+			.rate = capacity / std::chrono::duration_cast<fractional_seconds>(l.period).count(),
+			.tokens = capacity
+		});
+	}
+}
+
+rate_limiter::~rate_limiter() {
+	{
+		/* Waits for a pump already running, the ones after that find nothing to pump */
+		std::unique_lock lock{_self->mutex};
+
+		_self->limiter = nullptr;
+	}
+	std::unique_lock lock{_mutex};
+
+	if (_timer) {
+		_timers.cancel(_timer);
+	}
+	/* Nothing would ever resume whoever is still waiting, they get an exception instead */
+	for (queue& q : _waiters) {
+		for (awaiter* waiter = q.head; waiter;) {
+			awaiter* next = waiter->next;
+
+			waiter->abandoned = true;
+			_resume(waiter->coroutine);
+			waiter = next;
+		}
+		q = {};
+	}
+	_waiting = 0;
+}
+
+void rate_limiter::_resume(std::coroutine_handle<> handle) {
+	_timers.executor().queue([handle]() noexcept {
+		handle.resume();
+	});
+}
+
+void rate_limiter::_refill(app_timestamp now) noexcept {
+	if (now <= _refilled_at) {
+		return;
+	}
+	double elapsed = std::chrono::duration_cast<fractional_seconds>(now - _refilled_at).count();
+
+	for (bucket& b : _buckets) {
+		b.tokens = std::min(b.capacity, b.tokens + elapsed * b.rate);
+	}
+	_refilled_at = now;
+}
+
+bool rate_limiter::_take(app_timestamp now) noexcept {
+	if (now < _blocked_until) {
+		return false;
+	}
+	_refill(now);
+	if (!std::ranges::all_of(_buckets, [](const bucket& b) { return b.tokens >= 1.0; })) {
+		return false;
+	}
+	for (bucket& b : _buckets) {
+		b.tokens -= 1.0;
+	}
+	return true;
+}
+
+app_timestamp rate_limiter::_next_token(app_timestamp now) const noexcept {
+	/* Buckets don't refill while blocked */
+	app_timestamp from = std::max(now, _blocked_until);
+	app_timestamp next = from;
+
+	for (const bucket& b : _buckets) {
+		if (b.tokens < 1.0) {
+			auto wait = std::chrono::ceil<app_duration>(fractional_seconds{(1.0 - b.tokens) / b.rate});
+
+			next = std::max(next, from + wait);
+		}
+	}
+	return next;
+}
+
+bool rate_limiter::_has_waiters() const noexcept {
+	return std::ranges::any_of(_waiters, [](const queue& q) { return q.head != nullptr; });
+}
+
+void rate_limiter::_arm(app_timestamp now) {
+	if (_timer || !_has_waiters()) {
+		return;
+	}
+	_timer = _timers.schedule_after(_next_token(now) - now, [self = _self] {
+		std::vector<std::coroutine_handle<>> ready;
+		{
+			std::shared_lock lock{self->mutex};
+
+			if (!self->limiter) {
+				return;
+			}
+			ready = self->limiter->_pump();
+		}
+		/* Already on the thread pool: resumed in the order the tokens were handed out, with no lock held */
+		for (std::coroutine_handle<> handle : ready) {
+			handle.resume();
+		}
+	});
+}
+
+auto rate_limiter::_pump() -> std::vector<std::coroutine_handle<>> {
+	std::vector<std::coroutine_handle<>> ready;
+	std::unique_lock lock{_mutex};
+	auto now = app_clock::now();
+
+	_timer = 0;
+	while (_has_waiters() && _take(now)) {
+		size_t lane = _lanes.pick([this](size_t p) { return _waiters[p].head != nullptr; });
+		queue& q = _waiters[lane];
+
+		ready.push_back(std::exchange(q.head, q.head->next)->coroutine);
+		--_waiting;
+		if (!q.head) {
+			q.tail = nullptr;
+		}
+		_lanes.served(lane);
+	}
+	_arm(now);
+	return ready;
+}
+
+double rate_limiter::headroom() {
+	std::unique_lock lock{_mutex};
+	auto now = app_clock::now();
+
+	if (now < _blocked_until) {
+		return std::numeric_limits<double>::lowest();
+	}
+	_refill(now);
+	double ret = std::numeric_limits<double>::max();
+	for (const bucket& b : _buckets) {
+		ret = std::min(ret, (b.tokens - static_cast<double>(_waiting)) / b.capacity);
+	}
+	return ret;
+}
+
+void rate_limiter::throttle(app_duration delay) {
+	std::unique_lock lock{_mutex};
+	auto now = app_clock::now();
+
+	_refill(now);
+	_blocked_until = std::max(_blocked_until, now + delay);
+	for (bucket& b : _buckets) {
+		b.tokens = 0;
+	}
+	/* Nothing accrues while blocked, or the block would end in a burst straight back into the limit */
+	_refilled_at = _blocked_until;
+	/* An armed timer fires too early now, it re-arms itself for the new deadline */
+}
+
+bool rate_limiter::try_acquire(priority level) {
+	std::unique_lock lock{_mutex};
+
+	/* Don't overtake the coroutines already waiting */
+	if (!_has_waiters() && _take(app_clock::now())) {
+		_lanes.served(static_cast<size_t>(level));
+		return true;
+	}
+	return false;
+}
+
+void rate_limiter::awaiter::await_resume() const {
+	if (abandoned) {
+		throw exception{"rate limiter destroyed while waiting for a token"};
+	}
+}
+
+bool rate_limiter::awaiter::await_ready() {
+	return limiter.try_acquire(level);
+}
+
+bool rate_limiter::awaiter::await_suspend(std::coroutine_handle<> handle) {
+	std::unique_lock lock{limiter._mutex};
+	auto now = app_clock::now();
+
+	if (!limiter._has_waiters() && limiter._take(now)) {
+		limiter._lanes.served(static_cast<size_t>(level));
+		return false;
+	}
+	queue& q = limiter._waiters[static_cast<size_t>(level)];
+
+	coroutine = handle;
+	if (q.tail) {
+		q.tail->next = this;
+	} else {
+		q.head = this;
+	}
+	q.tail = this;
+	++limiter._waiting;
+	limiter._arm(now);
+	return true;
+}
+
+}
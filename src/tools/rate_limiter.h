@@ -0,0 +1,126 @@
+#ifndef MIMIRON_TOOLS_RATE_LIMITER_H_
+#define MIMIRON_TOOLS_RATE_LIMITER_H_
+
+#include <array>
+#include <coroutine>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include "common.h"
+#include "tools/backpressure.h"
+#include "tools/timer_wheel.h"
+
+namespace mimiron {
+
+/**
+ * Token buckets shared by one rate, a request needs a token from every bucket.
+ *
+ * Buckets refill continuously from the monotonic clock, so sustained throughput settles on the lowest limit
+ * no matter how coarse the timer waking the waiters is. Waiters are let through by priority, lower priorities keeping
+ * a minimum share of the tokens, then in order of arrival, and resumed on the timer wheel's thread pool.
+ */
+class rate_limiter {
+public:
+	/**
+	 * At most `requests` per `period`, which is also the largest burst allowed.
+	 */
+	struct limit {
+		size_t requests;
+		app_duration period;
+	};
+
+	struct awaiter {
+		bool await_ready();
+		bool await_suspend(std::coroutine_handle<> handle);
+		void await_resume() const;
+
+		rate_limiter& limiter;
+		priority level;
+		awaiter* next = nullptr;
+		std::coroutine_handle<> coroutine = {};
+		/* The limiter was destroyed while we waited */
+		bool abandoned = false;
+	};
+
+	rate_limiter(timer_wheel& timers, std::initializer_list<limit> limits, lane_scheduler::shares min_share = lane_scheduler::default_min_share);
+	~rate_limiter();
+
+	rate_limiter(const rate_limiter&) = delete;
+	rate_limiter& operator=(const rate_limiter&) = delete;
+
+	/**
+	 * Wait for a token from every bucket.
+	 *
+	 * @throws exception if the limiter is destroyed while waiting
+	 */
+	[[nodiscard]] awaiter acquire(priority level = priority::normal) noexcept {
+		return {*this, level};
+	}
+
+	/**
+	 * Take a token from every bucket only if one is there right now and no one is waiting for it.
+	 */
+	bool try_acquire(priority level = priority::normal);
+
+	/**
+	 * What is left of the tightest bucket as a fraction of its size, less the tokens owed to waiters.
+	 * Negative when in debt, lowest while throttled.
+	 */
+	double headroom();
+
+	/**
+	 * Stop handing out tokens for `delay` and empty the buckets, which only start refilling after that,
+	 * for when the server tells us to slow down.
+	 */
+	void throttle(app_duration delay);
+
+private:
+	using fractional_seconds = std::chrono::duration<double>;
+
+	struct queue {
+		awaiter* head = nullptr;
+		awaiter* tail = nullptr;
+	};
+
+	struct bucket {
+		double capacity;
+		/* Tokens per second */
+		double rate;
+		double tokens;
+	};
+
+	/**
+	 * What the timer callback holds on to: once expired it can't be cancelled anymore, so it may run after the limiter is gone.
+	 * Held shared while pumping, the destructor takes it to detach the limiter.
+	 */
+	struct self_handle {
+		std::shared_mutex mutex;
+		rate_limiter* limiter = nullptr;
+	};
+
+	void _refill(app_timestamp now) noexcept;
+	bool _take(app_timestamp now) noexcept;
+	app_timestamp _next_token(app_timestamp now) const noexcept;
+	void _arm(app_timestamp now);
+	std::vector<std::coroutine_handle<>> _pump();
+	void _resume(std::coroutine_handle<> handle);
+	bool _has_waiters() const noexcept;
+
+	timer_wheel& _timers;
+	std::mutex _mutex;
+	std::vector<bucket> _buckets;
+	app_timestamp _refilled_at = app_clock::now();
+	app_timestamp _blocked_until{};
+	std::array<queue, priority_count> _waiters;
+	size_t _waiting = 0;
+	lane_scheduler _lanes;
+	timer_wheel::timer_id _timer = 0;
+	std::shared_ptr<self_handle> _self = std::make_shared<self_handle>();
+};
+
+}
+
+#endif /* MIMIRON_TOOLS_RATE_LIMITER_H_ */
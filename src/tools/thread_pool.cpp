@@ -0,0 +1,127 @@
+#include "tools/thread_pool.h"
+
+#include <algorithm>
+
+namespace mimiron {
+
+namespace {
+
+/* Times an idle thread looks for work before parking */
+constexpr size_t spin_limit = 64;
+
+thread_local thread_pool* current_pool = nullptr;
+thread_local size_t current_index = 0;
+
+}
+
+thread_pool::thread_pool(size_t threads) :
+	_size{std::max<size_t>(threads, 1)},
+	_queues{std::make_unique<local_queue[]>(_size)},
+	_live_threads{_size}
+{
+	_threads.reserve(_size);
+	for (size_t i = 0; i < _size; ++i) {
+		_threads.emplace_back(&thread_pool::_run, this, i);
+	}
+}
+
+thread_pool::~thread_pool() {
+	_running.store(false, std::memory_order_release);
+	_epoch.fetch_add(1);
+	_epoch.notify_all();
+}
+
+void thread_pool::_push(work task) {
+	size_t index = current_pool == this ? current_index : _next_queue.fetch_add(1, std::memory_order_relaxed) % _size;
+
+	/* Counted before it is visible so that a thread taking it never brings the count below zero */
+	_pending.fetch_add(1);
+	{
+		std::unique_lock lock{_queues[index].mutex};
+
+		_queues[index].tasks.push_back(std::move(task));
+	}
+	if (_sleeping.load() > 0) {
+		_epoch.fetch_add(1);
+		_epoch.notify_one();
+	}
+}
+
+bool thread_pool::_pop(size_t index, work& task) {
+	/* Newest first from our own queue, its data is the most likely to still be in cache */
+	{
+		std::unique_lock lock{_queues[index].mutex};
+
+		if (auto& own = _queues[index].tasks; !own.empty()) {
+			task = std::move(own.back());
+			own.pop_back();
+			_pending.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	/* Oldest first from the others */
+	for (size_t i = 1; i < _size; ++i) {
+		local_queue& victim = _queues[(index + i) % _size];
+		std::unique_lock lock{victim.mutex, std::try_to_lock};
+
+		if (lock.owns_lock() && !victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			_pending.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool thread_pool::_next(size_t index, work& task) {
+	for (size_t spins = 0; _running.load(std::memory_order_acquire); ++spins) {
+		if (_pop(index, task)) {
+			return true;
+		}
+		if (spins < spin_limit) {
+			std::this_thread::yield();
+		} else {
+			_park();
+			spins = 0;
+		}
+	}
+	/* Stopping: finish what is already queued so that nobody is left awaiting work that never runs */
+	return _pop(index, task);
+}
+
+void thread_pool::_park() {
+	uint32_t epoch = _epoch.load();
+
+	/* A producer that increments _pending after we read it sees us in _sleeping and bumps the epoch */
+	_sleeping.fetch_add(1);
+	if (_pending.load() == 0 && _running.load(std::memory_order_acquire)) {
+		_epoch.wait(epoch);
+	}
+	_sleeping.fetch_sub(1);
+}
+
+void thread_pool::_run(size_t index) {
+	work task;
+
+	current_pool = this;
+	current_index = index;
+	while (_next(index, task)) {
+		task();
+		task = nullptr;
+	}
+	if (_live_threads.fetch_sub(1) == 1) {
+		_end_promise.set_value();
+	}
+}
+
+dpp::awaitable<void> thread_pool::stop() {
+	auto awaitable = _end_promise.get_awaitable();
+
+	_running.store(false, std::memory_order_release);
+	_epoch.fetch_add(1);
+	_epoch.notify_all();
+	return awaitable;
+}
+
+}
@@ -0,0 +1,154 @@
+#ifndef MIMIRON_TOOLS_THREAD_POOL_H_
+#define MIMIRON_TOOLS_THREAD_POOL_H_
+
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <dpp/coro/awaitable.h>
+
+#include "tools/backpressure.h"
+
+namespace mimiron {
+
+/**
+ * Pool of threads for blocking or CPU-heavy work that can run in parallel.
+ *
+ * Each thread has its own queue and steals from the others once it runs out of work.
+ * Work submitted from a pool thread goes to that thread's queue, work submitted from anywhere else is spread over all of them.
+ * Idle threads spin for a short while before parking until something is submitted.
+ *
+ * Unlike worker, nothing is guaranteed about which thread runs a task or in what order: anything that needs to stay on one thread,
+ * like a database connection, belongs on a worker.
+ */
+class thread_pool {
+public:
+	explicit thread_pool(size_t threads = std::thread::hardware_concurrency());
+	~thread_pool();
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	template <typename Fun>
+	requires (std::invocable<Fun>)
+	[[nodiscard]] dpp::awaitable<std::invoke_result_t<Fun>> schedule(Fun&& work) {
+		using ret = std::invoke_result_t<Fun>;
+
+		if (overloaded()) {
+			throw overloaded_exception{"thread pool queue is full"};
+		}
+
+		auto promise = dpp::promise<ret>{};
+		dpp::awaitable<ret> awaitable = promise.get_awaitable();
+
+		_push([fun = std::forward<Fun>(work), p = std::move(promise)]() mutable noexcept {
+			try {
+				if constexpr (std::is_void_v<ret>) {
+					std::invoke(std::forward<Fun>(fun));
+					p.set_value();
+				} else {
+					p.set_value(std::invoke(std::forward<Fun>(fun)));
+				}
+			} catch (...) {
+				p.set_exception(std::current_exception());
+			}
+		});
+		return awaitable;
+	}
+
+	template <typename Fun>
+	requires (std::invocable<Fun>)
+	void queue(Fun&& work) {
+		static_assert(std::is_nothrow_invocable_v<Fun>);
+
+		_push([fun = std::forward<Fun>(work)]() mutable noexcept {
+			std::invoke(std::forward<Fun>(fun));
+		});
+	}
+
+	struct hop {
+		bool await_ready() const noexcept {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> handle) {
+			pool._push([handle]() noexcept {
+				handle.resume();
+			});
+		}
+
+		void await_resume() const noexcept {}
+
+		thread_pool& pool;
+	};
+
+	/**
+	 * Resume the awaiting coroutine on one of the pool's threads, so that blocking or heavy code can follow inline.
+	 *
+	 * The task only holds the coroutine handle, which fits in the function's small buffer.
+	 */
+	[[nodiscard]] hop schedule_on() noexcept {
+		return {*this};
+	}
+
+	/**
+	 * Stop the threads once the queued work has run, the awaitable resolves when the last one is done.
+	 */
+	dpp::awaitable<void> stop();
+
+	size_t size() const noexcept {
+		return _size;
+	}
+
+	/**
+	 * Limit the number of queued tasks, past which schedule() throws overloaded_exception. 0 means unbounded.
+	 *
+	 * queue() and schedule_on() are never refused, they carry timers and coroutines that are already running.
+	 */
+	void set_capacity(size_t capacity) noexcept {
+		_capacity.store(capacity, std::memory_order_relaxed);
+	}
+
+	bool overloaded() const noexcept {
+		size_t capacity = _capacity.load(std::memory_order_relaxed);
+
+		return capacity != 0 && _pending.load(std::memory_order_relaxed) >= capacity;
+	}
+
+private:
+	using work = std::move_only_function<void() noexcept>;
+
+	struct local_queue {
+		std::mutex mutex;
+		std::deque<work> tasks;
+	};
+
+	void _push(work task);
+	bool _pop(size_t index, work& task);
+	bool _next(size_t index, work& task);
+	void _park();
+	void _run(size_t index);
+
+	size_t _size;
+	std::unique_ptr<local_queue[]> _queues;
+	std::atomic<size_t> _next_queue = 0;
+	/* Tasks sitting in any of the queues */
+	std::atomic<size_t> _pending = 0;
+	std::atomic<size_t> _capacity = 0;
+	std::atomic<size_t> _sleeping = 0;
+	/* Bumped to wake parked threads */
+	std::atomic<uint32_t> _epoch = 0;
+	std::atomic<bool> _running = true;
+	std::atomic<size_t> _live_threads;
+	dpp::promise<void> _end_promise;
+	std::vector<std::jthread> _threads;
+};
+
+}
+
+#endif /* MIMIRON_TOOLS_THREAD_POOL_H_ */
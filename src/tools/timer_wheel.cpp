@@ -0,0 +1,238 @@
+#include "tools/timer_wheel.h"
+
+#include <random>
+
+namespace mimiron {
+
+namespace {
+
+app_duration random_jitter(app_duration max) {
+	if (max <= app_duration::zero()) {
+		return {};
+	}
+	thread_local std::minstd_rand engine{std::random_device{}()};
+
+	return app_duration{std::uniform_int_distribution<app_duration::rep>{0, max.count()}(engine)};
+}
+
+}
+
+timer_wheel::timer_wheel(thread_pool& executor) :
+	_executor{executor}
+{}
+
+timer_wheel::~timer_wheel() {
+	stop();
+	for (auto& [_, n] : _timers) {
+		delete n;
+	}
+}
+
+uint64_t timer_wheel::_tick_of(app_timestamp time) const noexcept {
+	if (time <= _origin) {
+		return 0;
+	}
+	/* Rounded up, a timer never fires early */
+	return static_cast<uint64_t>((time - _origin + tick - app_duration{1}) / tick);
+}
+
+uint64_t timer_wheel::_ticks_elapsed(app_timestamp time) const noexcept {
+	return time <= _origin ? 0 : static_cast<uint64_t>((time - _origin) / tick);
+}
+
+void timer_wheel::_insert(node& n, uint64_t min_tick) noexcept {
+	n.expires = std::max(n.expires, min_tick);
+
+	uint64_t delta = n.expires - _current;
+	size_t level = 0;
+
+	while (level < level_count - 1 && delta >= (uint64_t{1} << (level_bits * (level + 1)))) {
+		++level;
+	}
+	/* Beyond the top level: park it one turn away, it's put back in place when its slot is cascaded */
+	uint64_t position = std::min(n.expires, _current + (uint64_t{1} << (level_bits * level_count)) - 1);
+	link& head = _slots[level][(position >> (level_bits * level)) & (slot_count - 1)];
+
+	n.prev = head.prev;
+	n.next = &head;
+	head.prev->next = &n;
+	head.prev = &n;
+}
+
+void timer_wheel::_unlink(node& n) noexcept {
+	n.prev->next = n.next;
+	n.next->prev = n.prev;
+	n.prev = n.next = &n;
+	--_pending;
+}
+
+void timer_wheel::_add(node& n) {
+	n.expires = _tick_of(n.deadline);
+	{
+		std::unique_lock lock{_mutex};
+
+		if (_pending == 0) {
+			/* The wheel stops turning while empty, catch up now that nothing can be skipped */
+			_current = std::max(_current, _ticks_elapsed(app_clock::now()));
+		}
+		_insert(n, _current + 1);
+		++_pending;
+	}
+	_cv.notify_one();
+}
+
+auto timer_wheel::_add(std::unique_ptr<node> n) -> timer_id {
+	n->expires = _tick_of(n->deadline);
+
+	std::unique_lock lock{_mutex};
+	timer_id id = _next_id++;
+
+	if (_pending == 0) {
+		_current = std::max(_current, _ticks_elapsed(app_clock::now()));
+	}
+	n->id = id;
+	_insert(*n, _current + 1);
+	++_pending;
+	_timers.emplace(id, n.release());
+	lock.unlock();
+	_cv.notify_one();
+	return id;
+}
+
+auto timer_wheel::schedule_at(app_timestamp when, callback function) -> timer_id {
+	auto n = std::make_unique<node>();
+
+	n->deadline = when;
+	n->function = std::make_shared<callback>(std::move(function));
+	return _add(std::move(n));
+}
+
+auto timer_wheel::every(app_duration period, callback function, app_duration jitter) -> timer_id {
+	auto n = std::make_unique<node>();
+
+	n->base = app_clock::now() + period;
+	n->deadline = n->base + random_jitter(jitter);
+	n->period = period;
+	n->jitter = jitter;
+	n->function = std::make_shared<callback>(std::move(function));
+	return _add(std::move(n));
+}
+
+bool timer_wheel::cancel(timer_id id) {
+	std::unique_lock lock{_mutex};
+	auto it = _timers.find(id);
+
+	if (it == _timers.end()) {
+		return false;
+	}
+	node* n = it->second;
+
+	_unlink(*n);
+	_timers.erase(it);
+	lock.unlock();
+	delete n;
+	return true;
+}
+
+void timer_wheel::stop() {
+	_thread.request_stop();
+	if (_thread.joinable()) {
+		_thread.join();
+	}
+}
+
+void timer_wheel::_advance(expired_timers& expired) {
+	++_current;
+
+	/* When a level wraps around, the next slot of the level above is spread over the levels below, highest first */
+	size_t cascades = 0;
+	while (cascades < level_count - 1 && ((_current >> (level_bits * cascades)) & (slot_count - 1)) == 0) {
+		++cascades;
+	}
+	for (size_t level = cascades; level > 0; --level) {
+		link& head = _slots[level][(_current >> (level_bits * level)) & (slot_count - 1)];
+		link* it = head.next;
+
+		head.prev = head.next = &head;
+		while (it != &head) {
+			link* next = it->next;
+
+			_insert(static_cast<node&>(*it), _current);
+			it = next;
+		}
+	}
+
+	link& head = _slots[0][_current & (slot_count - 1)];
+	link* it = head.next;
+
+	head.prev = head.next = &head;
+	while (it != &head) {
+		link* next = it->next;
+		node& n = static_cast<node&>(*it);
+
+		it = next;
+		if (n.expires > _current) {
+			/* Parked beyond the top level, not due yet */
+			_insert(n, _current + 1);
+		} else if (n.coroutine) {
+			--_pending;
+			n.prev = n.next = &n;
+			expired.coroutines.push_back(n.coroutine);
+		} else if (n.period > app_duration::zero()) {
+			/* Re-armed from the previous base so that the period drifts with neither the tick nor the jitter */
+			n.base += n.period;
+			n.deadline = n.base + random_jitter(n.jitter);
+			n.expires = _tick_of(n.deadline);
+			_insert(n, _current + 1);
+			expired.callbacks.push_back(n.function);
+		} else {
+			--_pending;
+			_timers.erase(n.id);
+			expired.callbacks.push_back(std::move(n.function));
+			delete &n;
+		}
+	}
+}
+
+void timer_wheel::_fire(expired_timers& expired) {
+	for (std::coroutine_handle<> coroutine : expired.coroutines) {
+		_executor.queue([coroutine]() noexcept {
+			coroutine.resume();
+		});
+	}
+	for (std::shared_ptr<callback>& function : expired.callbacks) {
+		_executor.queue([f = std::move(function)]() noexcept {
+			/* Callbacks are expected to report their own errors, nothing is left to handle them here */
+			try {
+				(*f)();
+			} catch (...) {
+			}
+		});
+	}
+	expired.coroutines.clear();
+	expired.callbacks.clear();
+}
+
+void timer_wheel::_run(std::stop_token stop) {
+	expired_timers expired;
+	std::unique_lock lock{_mutex};
+
+	while (!stop.stop_requested()) {
+		if (_pending == 0) {
+			_cv.wait(lock, stop, [this] { return _pending > 0; });
+			continue;
+		}
+		_cv.wait_until(lock, stop, _origin + tick * (_current + 1), [] { return false; });
+
+		for (uint64_t now = _ticks_elapsed(app_clock::now()); _current < now;) {
+			_advance(expired);
+		}
+		if (!expired.coroutines.empty() || !expired.callbacks.empty()) {
+			lock.unlock();
+			_fire(expired);
+			lock.lock();
+		}
+	}
+}
+
+}
@@ -0,0 +1,174 @@
+#ifndef MIMIRON_TOOLS_TIMER_WHEEL_H_
+#define MIMIRON_TOOLS_TIMER_WHEEL_H_
+
+#include <array>
+#include <condition_variable>
+#include <coroutine>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "tools/thread_pool.h"
+
+namespace mimiron {
+
+/**
+ * Hierarchical timer wheel: four levels of 64 slots, the first one turning every tick.
+ *
+ * Adding and cancelling a timer are O(1) and a pending timer costs one node, so keeping one per guild around is cheap.
+ * Timers expire at tick granularity, on the wheel's thread, which hands the callbacks and resumed coroutines to the thread pool.
+ * Timers further away than the top level can represent are parked in its last slot and re-examined when it comes around.
+ */
+class timer_wheel {
+public:
+	using timer_id = uint64_t;
+	using callback = std::function<void()>;
+
+	static constexpr app_duration tick = 100ms;
+
+private:
+	struct link {
+		link() = default;
+		link(const link&) = delete;
+		link& operator=(const link&) = delete;
+
+		link* prev = this;
+		link* next = this;
+	};
+
+	struct node : link {
+		uint64_t expires = 0;
+		app_timestamp deadline;
+		/* Unjittered deadline of a periodic timer, which the period is added to so that the jitter doesn't accumulate */
+		app_timestamp base;
+		app_duration period{};
+		app_duration jitter{};
+		timer_id id = 0;
+		std::shared_ptr<callback> function;
+		std::coroutine_handle<> coroutine;
+	};
+
+	struct sleeper : node {
+		sleeper(timer_wheel& w, app_timestamp when) noexcept : wheel{w} {
+			this->deadline = when;
+		}
+
+		bool await_ready() const noexcept {
+			return this->deadline <= app_clock::now();
+		}
+
+		void await_suspend(std::coroutine_handle<> handle) {
+			this->coroutine = handle;
+			wheel._add(*this);
+		}
+
+		void await_resume() noexcept {
+			/* Only the wheel resumes us, and it has already taken the node off */
+			this->coroutine = {};
+		}
+
+		/* A coroutine destroyed while it sleeps takes its timer off the wheel */
+		~sleeper() {
+			if (!this->coroutine) {
+				return;
+			}
+			std::unique_lock lock{wheel._mutex};
+
+			if (this->next != this) {
+				wheel._unlink(*this);
+			}
+		}
+
+		timer_wheel& wheel;
+	};
+
+public:
+	explicit timer_wheel(thread_pool& executor);
+	~timer_wheel();
+
+	timer_wheel(const timer_wheel&) = delete;
+	timer_wheel& operator=(const timer_wheel&) = delete;
+
+	/**
+	 * Resume the awaiting coroutine on the thread pool once `delay` has passed. The timer lives in the coroutine frame.
+	 */
+	[[nodiscard]] sleeper sleep_for(app_duration delay) noexcept {
+		return sleep_until(app_clock::now() + delay);
+	}
+
+	[[nodiscard]] sleeper sleep_until(app_timestamp when) noexcept {
+		return sleeper{*this, when};
+	}
+
+	/**
+	 * Run `function` on the thread pool at `when`.
+	 */
+	timer_id schedule_at(app_timestamp when, callback function);
+
+	timer_id schedule_after(app_duration delay, callback function) {
+		return schedule_at(app_clock::now() + delay, std::move(function));
+	}
+
+	/**
+	 * Run `function` on the thread pool every `period`, each run delayed by a random amount up to `jitter`
+	 * so that timers started together drift apart. Runs can overlap if the function takes longer than the period.
+	 */
+	timer_id every(app_duration period, callback function, app_duration jitter = {});
+
+	/**
+	 * Returns false if the timer had already fired, or never existed.
+	 */
+	bool cancel(timer_id id);
+
+	/**
+	 * Where expired callbacks and sleeping coroutines run.
+	 */
+	thread_pool& executor() noexcept {
+		return _executor;
+	}
+
+	/**
+	 * Stop the wheel's thread, nothing fires afterwards. Owners call this before destroying what the callbacks use.
+	 */
+	void stop();
+
+private:
+	static constexpr size_t level_bits = 6;
+	static constexpr size_t slot_count = size_t{1} << level_bits;
+	static constexpr size_t level_count = 4;
+
+	struct expired_timers {
+		std::vector<std::coroutine_handle<>> coroutines;
+		std::vector<std::shared_ptr<callback>> callbacks;
+	};
+
+	uint64_t _tick_of(app_timestamp time) const noexcept;
+	uint64_t _ticks_elapsed(app_timestamp time) const noexcept;
+	void _add(node& n);
+	timer_id _add(std::unique_ptr<node> n);
+	void _insert(node& n, uint64_t min_tick) noexcept;
+	void _unlink(node& n) noexcept;
+	void _advance(expired_timers& expired);
+	void _fire(expired_timers& expired);
+	void _run(std::stop_token stop);
+
+	thread_pool& _executor;
+	app_timestamp _origin = app_clock::now();
+	std::mutex _mutex;
+	std::condition_variable_any _cv;
+	uint64_t _current = 0;
+	size_t _pending = 0;
+	timer_id _next_id = 1;
+	std::array<std::array<link, slot_count>, level_count> _slots;
+	/* Heap-allocated timers that can be cancelled, sleepers live in their coroutine */
+	std::unordered_map<timer_id, node*> _timers;
+	std::jthread _thread{[this](std::stop_token stop) { _run(stop); }};
+};
+
+}
+
+#endif /* MIMIRON_TOOLS_TIMER_WHEEL_H_ */
@@ -34,6 +34,19 @@ inline constexpr bool is_optional = false;
 template <typename T>
 inline constexpr bool is_optional<std::optional<T>> = true;
 
+template <typename T>
+struct remove_optional {
+	using type = T;
+};
+
+template <typename T>
+struct remove_optional<std::optional<T>> {
+	using type = T;
+};
+
+template <typename T>
+using remove_optional_t = typename remove_optional<T>::type;
+
 template <typename Key, typename Value, typename Hasher = std::hash<Key>, typename Equal = std::equal_to<>>
 class cache;
 
@@ -2,30 +2,99 @@
 
 namespace mimiron {
 
-void worker::_run() {
-	std::unique_lock lock{mutex, std::defer_lock};
-
-	running = true;
-	while (true) {
-		lock.lock();
-		cv.wait(lock, [this]() { return !running.load(std::memory_order_acquire) || !work_queue.empty(); });
-		if (!running.load(std::memory_order_relaxed)) {
-			break;
+worker::~worker() {
+	running.store(false, std::memory_order_release);
+	_wakeups.fetch_add(1);
+	_wakeups.notify_one();
+	thread.join();
+	while (node* n = _pop()) {
+		n->discard();
+	}
+}
+
+void worker::_admit() {
+	size_t capacity = _capacity.load(std::memory_order_relaxed);
+
+	if (_size.fetch_add(1, std::memory_order_relaxed) >= capacity && capacity != 0) {
+		_size.fetch_sub(1, std::memory_order_relaxed);
+		throw overloaded_exception{"worker queue is full"};
+	}
+}
+
+void worker::_push(node* n) noexcept {
+	node* prev = _head.exchange(n);
+
+	prev->next.store(n, std::memory_order_release);
+	/* Only the first producer to see the thread parked pays for the wakeup */
+	if (_parked.exchange(false)) {
+		_wakeups.fetch_add(1);
+		_wakeups.notify_one();
+	}
+}
+
+auto worker::_pop() noexcept -> node* {
+	node* tail = _tail;
+	node* next = tail->next.load(std::memory_order_acquire);
+
+	if (tail == &_stub) {
+		if (!next) {
+			return nullptr;
 		}
-		std::vector<work> requests = std::move(work_queue);
-		lock.unlock();
-		for (work &fun : requests) {
-			fun();
+		_tail = next;
+		tail = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+	if (next) {
+		_tail = next;
+		return tail;
+	}
+	if (tail != _head.load()) {
+		/* A producer swapped _head but hasn't linked its node yet */
+		return nullptr;
+	}
+	/* tail is the last node, put the stub behind it so it can be handed out */
+	_stub.next.store(nullptr, std::memory_order_relaxed);
+	_push(&_stub);
+	next = tail->next.load(std::memory_order_acquire);
+	if (next) {
+		_tail = next;
+		return tail;
+	}
+	return nullptr;
+}
+
+void worker::_park() noexcept {
+	uint32_t seen = _wakeups.load();
+
+	/* A producer that swaps _head after our check below sees _parked and wakes us */
+	_parked.store(true);
+	if (_head.load() == _tail && running.load(std::memory_order_acquire)) {
+		_wakeups.wait(seen);
+	}
+	_parked.store(false);
+}
+
+void worker::_run() {
+	while (running.load(std::memory_order_acquire)) {
+		if (node* n = _pop(); n) {
+			_size.fetch_sub(1, std::memory_order_relaxed);
+			n->run();
+		} else if (_head.load() == _tail) {
+			_park();
+		} else {
+			std::this_thread::yield();
 		}
 	}
 	end_promise.set_value();
 }
 
 dpp::awaitable<void> worker::stop() {
+	auto awaitable = end_promise.get_awaitable();
+
 	running.store(false, std::memory_order_release);
-	cv.notify_all();
-	return end_promise.get_awaitable();
+	_wakeups.fetch_add(1);
+	_wakeups.notify_one();
+	return awaitable;
 }
 
-
 }
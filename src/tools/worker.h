@@ -1,35 +1,55 @@
 #ifndef MIMIRON_TOOLS_WORKER_H_
 #define MIMIRON_TOOLS_WORKER_H_
 
-#include <vector>
+#include <atomic>
+#include <coroutine>
 #include <functional>
 #include <thread>
-#include <mutex>
 #include <memory>
 #include <utility>
 
 #include <dpp/coro/awaitable.h>
 
+#include "tools/backpressure.h"
+
 namespace mimiron {
 
+/**
+ * Single thread running work in the order it was submitted.
+ *
+ * Submissions go through an intrusive lock-free queue: each one costs a single allocation holding both the work and the link,
+ * and only wakes the thread when it is parked.
+ */
 class worker {
 public:
+	worker() = default;
+	~worker();
+
+	worker(const worker&) = delete;
+	worker& operator=(const worker&) = delete;
+
 	template <typename Fun>
 	requires (std::invocable<Fun>)
 	[[nodiscard]] dpp::awaitable<std::invoke_result_t<Fun>> schedule(Fun&& work) {
 		using ret = std::invoke_result_t<Fun>;
+
+		_admit();
+
 		auto promise = dpp::promise<ret>{};
 		dpp::awaitable<ret> awaitable = promise.get_awaitable();
-		std::unique_lock lock{mutex};
 
-		work_queue.emplace_back([fun = std::forward<Fun>(work), p = std::move(promise)]() mutable noexcept {
+		_push(_make_node([fun = std::forward<Fun>(work), p = std::move(promise)]() mutable noexcept {
 			try {
-				p.set_value(std::invoke(std::forward<Fun>(fun)));
+				if constexpr (std::is_void_v<ret>) {
+					std::invoke(std::forward<Fun>(fun));
+					p.set_value();
+				} else {
+					p.set_value(std::invoke(std::forward<Fun>(fun)));
+				}
 			} catch (...) {
 				p.set_exception(std::current_exception());
 			}
-		});
-		cv.notify_all();
+		}));
 		return awaitable;
 	}
 
@@ -38,25 +58,119 @@ public:
 	void queue(Fun&& work) {
 		static_assert(std::is_nothrow_invocable_v<Fun>);
 
-		std::unique_lock lock{mutex};
-
-		work_queue.emplace_back([fun = std::forward<Fun>(work)]() mutable noexcept {
-			std::invoke(std::forward<Fun>(fun));
-		});
-		cv.notify_all();
+		_size.fetch_add(1, std::memory_order_relaxed);
+		_push(_make_node(std::forward<Fun>(work)));
 	}
 
 	dpp::awaitable<void> stop();
 
+	/**
+	 * Limit the number of tasks waiting to run, past which schedule() throws overloaded_exception. 0 means unbounded.
+	 *
+	 * queue() and schedule_on() are never refused, they are meant for internal work and for coroutines that are already running.
+	 */
+	void set_capacity(size_t capacity) noexcept {
+		_capacity.store(capacity, std::memory_order_relaxed);
+	}
+
+	size_t size() const noexcept {
+		return _size.load(std::memory_order_relaxed);
+	}
+
+	bool overloaded() const noexcept {
+		size_t capacity = _capacity.load(std::memory_order_relaxed);
+
+		return capacity != 0 && size() >= capacity;
+	}
+
+private:
+	/**
+	 * Link in the queue, run() is called once on the worker thread and is responsible for the node from then on.
+	 */
+	struct node {
+		virtual ~node() = default;
+
+		virtual void run() noexcept {}
+
+		/* Called instead of run() for work that is still queued when the worker is destroyed */
+		virtual void discard() noexcept {}
+
+		std::atomic<node*> next = nullptr;
+	};
+
+	struct hop : node {
+		hop(worker& w) noexcept : target{w} {}
+
+		bool await_ready() const noexcept {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> handle) noexcept {
+			coroutine = handle;
+			target._size.fetch_add(1, std::memory_order_relaxed);
+			target._push(this);
+		}
+
+		void await_resume() const noexcept {}
+
+		void run() noexcept override {
+			coroutine.resume();
+		}
+
+		worker& target;
+		std::coroutine_handle<> coroutine;
+	};
+
+public:
+	/**
+	 * Resume the awaiting coroutine on the worker thread, so that blocking code can follow inline.
+	 *
+	 * The queue node lives in the coroutine frame, this does not allocate.
+	 */
+	[[nodiscard]] hop schedule_on() noexcept {
+		return hop{*this};
+	}
+
 private:
+
+	template <typename Fun>
+	struct function_node : node {
+		template <typename F>
+		function_node(F&& f) : fun{std::forward<F>(f)} {}
+
+		void run() noexcept override {
+			std::invoke(fun);
+			delete this;
+		}
+
+		void discard() noexcept override {
+			delete this;
+		}
+
+		Fun fun;
+	};
+
+	template <typename Fun>
+	static node* _make_node(Fun&& fun) {
+		return new function_node<std::remove_cvref_t<Fun>>{std::forward<Fun>(fun)};
+	}
+
+	void _admit();
+	void _push(node* n) noexcept;
+	node* _pop() noexcept;
+	void _park() noexcept;
 	void _run();
 
-  using work = std::move_only_function<void() noexcept>;
-  std::mutex mutex;
+	/* Producers append at _head, the thread consumes from _tail, _stub keeps the list from ever being empty */
+	node _stub;
+	std::atomic<node*> _head = &_stub;
+	node* _tail = &_stub;
+	std::atomic<bool> _parked = false;
+	std::atomic<size_t> _size = 0;
+	std::atomic<size_t> _capacity = 0;
+	std::atomic<uint32_t> _wakeups = 0;
 	dpp::promise<void> end_promise;
-  std::condition_variable cv;
-  std::vector<work> work_queue;
-	std::atomic<bool> running = false;
+	std::atomic<bool> running = true;
 	std::jthread thread{&worker::_run, this};
 };
 
@@ -3,10 +3,14 @@
 #include <fstream>
 #include <chrono>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
 
 #include <boost/pfr.hpp>
 #include "api_handler.h"
 
+#include "exception.h"
 #include "database/database.h"
 #include "tools/parse_json.h"
 #include "tools/tuple.h"
@@ -208,68 +212,40 @@ std::shared_mutex cache_mutex;
 template <typename T>
 cache<std::string, T> resource_cache;
 
-constexpr fixed_string<32> resource_namespace(resource_location const& loc, api_namespace n) noexcept {
-	fixed_string<32> ret;
-	fixed_string<32>::iterator_t it = ret.begin();
-
-	switch (n) {
-		case api_static:
-			it = std::copy_n("static", 6, it);
-			break;
-
-		case api_dynamic:
-			it = std::copy_n("dynamic", 7, it);
-			break;
-
-		case api_profile:
-			it = std::copy_n("profile", 7, it);
-			break;
-	}
-
-	switch (loc.version) {
-		case retail:
-			break;
-
-		case progression:
-			it = std::copy_n("-classic", 8, it);
-			break;
-
-		case classic_era:
-			it = std::copy_n("-classic1x", 10, it);
-			break;
-	}
-	*it = '-';
-	++it;
-	*it = loc.region_code[0];
-	++it;
-	*it = loc.region_code[1];
-	++it;
-	ret.str_size = std::distance(ret.begin(), it);
-	std::fill(it, ret.str.end(), 0);
-	return {ret};
 }
 
-constexpr std::pair<std::string, std::string> namespace_header(resource_location const& loc, api_namespace n) {
-	return {"Battlenet-Namespace", std::string{resource_namespace(loc, n)}};
-}
-
-}
+api_handler::client::client(dpp::cluster& cluster, timer_wheel& timers, api_credentials credentials, const queue_settings& settings, const std::string& oauth_url) :
+	tokens{cluster, timers, std::move(credentials), oauth_url},
+	limiter{timers, {{settings.requests_per_second, 1s}, {settings.requests_per_hour, 1h}}, settings.min_share}
+{}
 
-api_handler::api_handler(dpp::cluster& cluster, std::string_view api_id, std::string_view api_token) :
+api_handler::api_handler(dpp::cluster& cluster, thread_pool& pool, timer_wheel& timers, std::vector<api_credentials> clients, queue_settings settings, endpoints targets) :
 	_cluster{cluster},
-	_api_id{api_id},
-	_api_token{api_token}
+	_timers{timers},
+	_retry{settings.retry},
+	_endpoints{std::move(targets)},
+	_admission{pool, settings.max_in_flight, settings.policy, settings.max_waiting, settings.min_share},
+	_hedging{settings.hedging}
 {
+	if (clients.empty()) {
+		throw exception{"no WoW API credentials"};
+	}
+	_admission.set_tenant_burst(settings.tenant_burst);
+	for (const auto& [tenant, weight] : settings.tenant_weights) {
+		_admission.set_tenant_weight(tenant, weight);
+	}
+	_clients.reserve(clients.size());
+	for (api_credentials& credentials : clients) {
+		_clients.push_back(std::make_unique<client>(cluster, timers, std::move(credentials), settings, _endpoints.oauth_url));
+	}
 }
 
 dpp::coroutine<> api_handler::start() {
-	_cluster.log(dpp::ll_info, "initializing communication with the WoW API");
-	auto credentials = co_await _request_access();
+	_cluster.log(dpp::ll_info, std::format("initializing communication with the WoW API with {} client(s)", _clients.size()));
+	for (const std::unique_ptr<client>& c : _clients) {
+		co_await c->tokens.start();
+	}
 	_cluster.log(dpp::ll_info, "communication with the WoW API established\n");
-	std::scoped_lock lock{_credentials_mutex};
-
-	_api_credentials = std::move(credentials);
-	co_return;
 }
 
 
@@ -336,34 +312,11 @@ dpp::coroutine<> api_handler::start() {
 		}
 	}*/
 
-dpp::coroutine<client_credentials> api_handler::_request_access() {
-	_cluster.log(dpp::ll_info, "querying the WoW API for an authorization token...");
-	std::string auth = std::format("{}:{}", _api_id, _api_token);
-	dpp::promise<dpp::http_request_completion_t> p;
-	_cluster.request(
-		"https://oauth.battle.net/token", dpp::m_post,
-		[&] (const dpp::http_request_completion_t& result) { p.set_value(result); },
-		"grant_type=client_credentials",
-		"application/x-www-form-urlencoded", {
-			{"Authorization", "Basic " + dpp::base64_encode(reinterpret_cast<unsigned char*>(auth.data()), static_cast<uint32_t>(auth.size()))}
-		},
-		"1.0"
-	);
-	auto result = co_await p.get_awaitable();
-	if (result.status >= 300) {
-		throw dpp::rest_exception{"bad wow api credentials"};
-	}
-	auto credentials = parse_json<client_credentials>(nlohmann::json::parse(result.body));
-
-	_cluster.log(dpp::ll_info, std::format("WoW API authorization token obtained, expires in {}", std::chrono::hh_mm_ss{seconds{credentials.expires_in}}));
-	co_return credentials;
-}
-
 /*auto api_handler::get_realms(const resource_location& location) -> async_request<std::vector<realm_entry>> {
 	co_return co_await _fetch<std::vector<realm_entry>>(request{
 		.host = location.host,
 		.path = "/data/wow/realm/",
-		.ns = std::string{resource_namespace(location, api_dynamic)},
+		.ns = std::string{namespace_of(location, api_dynamic)},
 		.output_field = "realms",
 	}, "index");
 }
@@ -372,7 +325,7 @@ auto api_handler::get_realm(const resource_location& location, std::string_view
 	co_return co_await _fetch<realm>(request{
 		.host = location.host,
 		.path = "/data/wow/realm/",
-		.ns = std::string{resource_namespace(location, api_dynamic)}
+		.ns = std::string{namespace_of(location, api_dynamic)}
 	}, realm_slug);
 }
 
@@ -380,12 +333,12 @@ auto api_handler::get_realm(const resource_location& location, uint64_t id) -> a
 	co_return co_await _fetch<realm>(request{
 		.host = location.host,
 		.path = "/data/wow/realm/",
-		.ns = std::string{resource_namespace(location, api_dynamic)}
+		.ns = std::string{namespace_of(location, api_dynamic)}
 	}, id);
 }*/
 
-auto api_handler::get(std::string_view path, std::string_view resource_namespace) -> async_request {
-	return _queue(path, resource_namespace);
+auto api_handler::get(std::string_view path, std::string_view resource_namespace, priority level, tenant_id tenant, cache_validators conditional) -> async_request {
+	return _queue(path, resource_namespace, level, tenant, std::move(conditional));
 }
 
 namespace {
@@ -422,55 +375,348 @@ rest_resource _parse_response(dpp::http_request_completion_t& result) {
 			ret.cache_control.age = std::chrono::duration_cast<system_clock::duration>(seconds{age});
 		}
 	}
-	ret.data = std::vector<std::byte>{reinterpret_cast<std::byte const*>(result.body.data()), reinterpret_cast<std::byte const*>(result.body.data()) + result.body.size()};
+	if (auto it = result.headers.find("etag"); it != result.headers.end()) {
+		ret.validators.etag = it->second;
+	}
+	if (auto it = result.headers.find("last-modified"); it != result.headers.end()) {
+		ret.validators.last_modified = it->second;
+	}
+	if (result.status == 304) {
+		ret.not_modified = true;
+		return ret;
+	}
+	ret.body = std::move(result.body);
 	return ret;
 }
 
+/**
+ * Splits a URL into its scheme and host, and the rest.
+ */
+std::pair<std::string_view, std::string_view> split_origin(std::string_view url) {
+	size_t host = url.find("://");
+	size_t path = url.find('/', host == std::string_view::npos ? 0 : host + 3);
+
+	if (path == std::string_view::npos) {
+		return {url, {}};
+	}
+	return {url.substr(0, path), url.substr(path)};
 }
 
-auto api_handler::_do_request(dpp::http_method method, std::string_view path, std::string_view resource_namespace) -> async_request {
-	std::multimap<std::string, std::string> headers{
-		{ "Battlenet-Namespace", std::string{resource_namespace} }
+/**
+ * Route of a URL: its host and path, without the query nor the last segment so that every realm shares one.
+ */
+std::string endpoint_of(std::string_view url) {
+	url = url.substr(0, url.find('?'));
+	return std::string{url.substr(0, url.rfind('/') + 1)};
+}
+
+/**
+ * A request and its hedge racing each other. The first successful response, or the last error, is handed to the waiting coroutine.
+ */
+struct hedged_exchange : std::enable_shared_from_this<hedged_exchange> {
+	using result_type = std::variant<rest_resource, dpp::error_info>;
+
+	struct awaiter {
+		bool await_ready() const {
+			std::unique_lock lock{exchange.mutex};
+
+			return exchange.result.has_value();
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle) {
+			std::unique_lock lock{exchange.mutex};
+
+			if (exchange.result) {
+				return false;
+			}
+			exchange.waiter = handle;
+			if (timeout) {
+				exchange.timer = timers.schedule_after(*timeout, [self = exchange.shared_from_this()] { self->wake(); });
+			}
+			return true;
+		}
+
+		/* False if the timeout passed before a response came in */
+		bool await_resume() const {
+			std::unique_lock lock{exchange.mutex};
+
+			return exchange.result.has_value();
+		}
+
+		hedged_exchange& exchange;
+		timer_wheel& timers;
+		std::optional<app_duration> timeout;
 	};
 
-	{
-		std::shared_lock lock{_credentials_mutex};
+	hedged_exchange(std::string_view url, std::string_view ns, const cache_validators& validators) :
+		path{url},
+		resource_namespace{ns},
+		conditional{validators}
+	{}
 
-		if (minutes{_api_credentials.expires_in} < 5min) {
-			lock.unlock();
+	[[nodiscard]] awaiter wait(timer_wheel& timers, std::optional<app_duration> timeout = std::nullopt) noexcept {
+		return {*this, timers, timeout};
+	}
+
+	/**
+	 * Count one more request in the race, false if it is already over.
+	 */
+	bool begin() {
+		std::unique_lock lock{mutex};
 
-			std::unique_lock lock_{_credentials_mutex};
+		if (result) {
+			return false;
+		}
+		++pending;
+		return true;
+	}
 
-			if (minutes{_api_credentials.expires_in} < 5min) {
-				_api_credentials = co_await _request_access();
+	void deliver(result_type response, timer_wheel& timers) {
+		std::coroutine_handle<> handle;
+		timer_wheel::timer_id timeout;
+		{
+			std::unique_lock lock{mutex};
+
+			--pending;
+			/* An error only counts once nothing else can answer */
+			if (result || (std::holds_alternative<dpp::error_info>(response) && pending > 0)) {
+				return;
 			}
+			result = std::move(response);
+			handle = std::exchange(waiter, {});
+			timeout = std::exchange(timer, 0);
+		}
+		if (timeout) {
+			timers.cancel(timeout);
+		}
+		if (handle) {
+			handle.resume();
+		}
+	}
+
+	void wake() {
+		std::coroutine_handle<> handle;
+		{
+			std::unique_lock lock{mutex};
+
+			timer = 0;
+			handle = std::exchange(waiter, {});
+		}
+		if (handle) {
+			handle.resume();
 		}
-		headers.emplace("Authorization", "Bearer " + _api_credentials.access_token);
 	}
 
-	dpp::http_request_completion_t result = co_await _cluster.co_request(std::string{path}, method, {}, "application/x-www-form-urlencoded", headers, "1.0");
+	result_type take() {
+		std::unique_lock lock{mutex};
+
+		return std::move(*result);
+	}
 
-	if (result.status >= 300) {
+	std::string path;
+	std::string resource_namespace;
+	cache_validators conditional;
+
+	std::mutex mutex;
+	std::optional<result_type> result;
+	std::coroutine_handle<> waiter;
+	timer_wheel::timer_id timer = 0;
+	size_t pending = 0;
+};
+
+/**
+ * Delay asked for by a 429 or 503 response, only the delta-seconds form of Retry-After is understood.
+ */
+std::optional<app_duration> _retry_after(const dpp::http_request_completion_t& result) {
+	if (auto it = result.headers.find("retry-after"); it != result.headers.end()) {
+		seconds::rep delay;
+
+		if (auto [_, errc] = from_chars(it->second, delay); errc == std::errc{} && delay >= 0) {
+			return seconds{delay};
+		}
+	}
+	return std::nullopt;
+}
+
+/**
+ * Whether a request that failed with this status may succeed if sent again; 0 is a transport failure.
+ */
+constexpr bool is_retryable(uint32_t status) noexcept {
+	switch (status) {
+		case 0:
+		case 408:
+		case 429:
+		case 500:
+		case 502:
+		case 503:
+		case 504:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+/**
+ * Decorrelated jitter: the next delay is drawn between the base and three times the previous one, then capped.
+ */
+app_duration next_backoff(app_duration base, app_duration previous, app_duration cap) {
+	thread_local std::minstd_rand rng{std::random_device{}()};
+	std::uniform_int_distribution<app_duration::rep> dist{base.count(), std::max(base, previous * 3).count()};
+
+	return std::min(app_duration{dist(rng)}, cap);
+}
+
+}
+
+auto api_handler::_pick_client() -> client& {
+	client* best = _clients.front().get();
+	double best_headroom = best->limiter.headroom();
+
+	for (const std::unique_ptr<client>& c : _clients | std::views::drop(1)) {
+		if (double headroom = c->limiter.headroom(); headroom > best_headroom) {
+			best = c.get();
+			best_headroom = headroom;
+		}
+	}
+	return *best;
+}
+
+auto api_handler::_do_request(client& sender, dpp::http_method method, std::string_view path, std::string_view resource_namespace, const cache_validators& conditional) -> async_request {
+	std::multimap<std::string, std::string> headers{
+		{ "Battlenet-Namespace", std::string{resource_namespace} }
+	};
+
+	if (!conditional.etag.empty()) {
+		headers.emplace("If-None-Match", conditional.etag);
+	}
+	if (!conditional.last_modified.empty()) {
+		headers.emplace("If-Modified-Since", conditional.last_modified);
+	}
+
+	if (auto token = sender.tokens.current(); token) {
+		headers.emplace("Authorization", "Bearer " + token->bearer);
+	}
+
+	std::string url = _endpoints.api_base_url.empty() ? std::string{path} : _endpoints.api_base_url + std::string{split_origin(path).second};
+	dpp::http_request_completion_t result = co_await _cluster.co_request(url, method, {}, "application/x-www-form-urlencoded", headers, "1.0");
+
+	/* No response at all, reported as status 0 so that it is retried like one */
+	if (result.error != dpp::h_success || result.status == 0) {
+		co_return dpp::error_info{0, "could not reach the WoW API", {}, std::format("could not reach the WoW API (error {})", static_cast<int>(result.error))};
+	}
+	if (auto retry_after = _retry_after(result); result.status == 429 || (result.status == 503 && retry_after)) {
+		app_duration delay = retry_after.value_or(1s);
+
+		_cluster.log(dpp::ll_warning, std::format("WoW API rate limit hit, pausing requests for {}", std::chrono::duration_cast<seconds>(delay)));
+		sender.limiter.throttle(delay);
+	}
+	if (result.status >= 300 && result.status != 304) {
 		co_return dpp::error_info{result.status, {}, {}, {}};
 	}
+	if (result.status == 200 && !_endpoints.record_fixtures.empty()) {
+		_record(path, resource_namespace, result.body);
+	}
 	co_return _parse_response(result);
 }
 
+auto api_handler::_send(client& sender, std::string_view path, std::string_view resource_namespace, priority level, const cache_validators& conditional) -> async_request {
+	std::string endpoint = endpoint_of(path);
+	std::optional<app_duration> hedge_after = _hedging.on_request(endpoint);
+
+	if (!hedge_after) {
+		auto started = app_clock::now();
+		auto result = co_await _do_request(sender, dpp::m_get, path, resource_namespace, conditional);
+
+		if (std::holds_alternative<rest_resource>(result)) {
+			_hedging.record(endpoint, app_clock::now() - started);
+		}
+		co_return result;
+	}
+
+	/* The losing request finishes on its own, so it keeps its own copy of everything it needs */
+	auto exchange = std::make_shared<hedged_exchange>(path, resource_namespace, conditional);
+	auto attempt = [](api_handler& self, client& c, std::shared_ptr<hedged_exchange> ex, std::string route) -> dpp::job {
+		auto started = app_clock::now();
+		auto result = co_await self._do_request(c, dpp::m_get, ex->path, ex->resource_namespace, ex->conditional);
+
+		if (std::holds_alternative<rest_resource>(result)) {
+			self._hedging.record(route, app_clock::now() - started);
+		}
+		ex->deliver(std::move(result), self._timers);
+	};
+
+	exchange->begin();
+	attempt(*this, sender, exchange, endpoint);
+	if (!co_await exchange->wait(_timers, *hedge_after) && _hedging.try_hedge()) {
+		client& hedger = _pick_client();
+
+		/* A hedge is a request like any other for the quota, but it is not worth waiting for a token */
+		if (hedger.limiter.try_acquire(level) && exchange->begin()) {
+			_cluster.log(dpp::ll_debug, std::format("WoW API request {} slower than {}, hedging", path, std::chrono::duration_cast<milliseconds>(*hedge_after)));
+			attempt(*this, hedger, exchange, endpoint);
+		} else {
+			_hedging.refund();
+		}
+	}
+	/* A stale timeout can wake us before the response is in */
+	while (!co_await exchange->wait(_timers)) {
+	}
+	co_return exchange->take();
+}
+
+void api_handler::_record(std::string_view url, std::string_view resource_namespace, std::string_view body) const {
+	/* Same layout as tools/mock_api: <namespace>/<path>[@<query>].json */
+	std::string file{split_origin(url).second};
+
+	if (auto query = file.find('?'); query != std::string::npos) {
+		file[query] = '@';
+	}
+	stdfs::path fixture = _endpoints.record_fixtures / resource_namespace / (file.substr(file.find_first_not_of('/') == std::string::npos ? file.size() : file.find_first_not_of('/')) + ".json");
+	std::error_code err;
 
-auto api_handler::_queue(std::string_view path, std::string_view resource_namespace) -> async_request {
-	std::unique_lock lock{_queue_mutex};
-	if (_requests_last_hour.size() >= 32000 || _requests_last_second.size() >= 80) {
-		dpp::promise<void> queue_promise;
-		_requests_queue.push(&queue_promise);
-		lock.unlock();
-		co_await queue_promise.get_awaitable();
+	create_directories(fixture.parent_path(), err);
+	if (std::ofstream fs{fixture, std::ios::out | std::ios::binary | std::ios::trunc}; fs.good()) {
+		fs.write(body.data(), static_cast<std::streamsize>(body.size()));
 	} else {
-		auto now = app_clock::now();
-		_requests_last_hour.push(now);
-		_requests_last_second.push(now);
-		lock.unlock();
+		_cluster.log(dpp::ll_warning, "could not record fixture " + fixture.string());
+	}
+}
+
+
+auto api_handler::_queue(std::string_view path, std::string_view resource_namespace, priority level, tenant_id tenant, cache_validators conditional) -> async_request {
+	app_timestamp deadline = app_clock::now() + _retry.deadline;
+	/* Held while an attempt waits for its token and its response, bounds both the requests in flight and the ones waiting behind them */
+	admission_gate::ticket ticket = co_await _admission.enter(level, tenant);
+	app_duration backoff = _retry.base_delay;
+
+	for (size_t attempt = 1;; ++attempt) {
+		/* Every attempt pays for its own token, a 429 or 503 has throttled its client for as long as we were told to */
+		client& sender = _pick_client();
+
+		co_await sender.limiter.acquire(level);
+
+		auto result = co_await _send(sender, path, resource_namespace, level, conditional);
+		auto* error = std::get_if<dpp::error_info>(&result);
+
+		if (!error || !is_retryable(error->code) || attempt >= _retry.max_attempts) {
+			co_return result;
+		}
+		backoff = next_backoff(_retry.base_delay, backoff, _retry.max_delay);
+		if (app_clock::now() + backoff >= deadline) {
+			co_return result;
+		}
+		_cluster.log(dpp::ll_debug, std::format("WoW API request {} failed with {}, attempt {} of {} in {}", path, error->code, attempt + 1, _retry.max_attempts, std::chrono::duration_cast<milliseconds>(backoff)));
+		/* A request sleeping off its backoff takes no slot, the next attempt goes through the gate again */
+		ticket = {};
+		co_await _timers.sleep_for(backoff);
+		try {
+			ticket = co_await _admission.enter(level, tenant);
+		} catch (const overloaded_exception&) {
+			/* Refused on the way back in, the caller gets the failure we were retrying */
+			co_return result;
+		}
 	}
-	co_return co_await _do_request(dpp::m_get, path, resource_namespace);
 }
 
 }
@@ -2,6 +2,11 @@
 #define MIMIRON_WOW_API_HANDLER
 
 #include <any>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <vector>
 
 #include <dpp/cluster.h>
 #include <dpp/coro/awaitable.h>
@@ -9,7 +14,11 @@
 #include "tools/cache.h"
 
 #include "common.h"
+#include "tools/backpressure.h"
+#include "tools/hedging.h"
+#include "tools/rate_limiter.h"
 #include "tools/worker.h"
+#include "wow/api/token_manager.h"
 #include "wow/api/region.h"
 #include "wow/api/realm.h"
 
@@ -27,38 +36,132 @@ struct cache_settings {
 	std::optional<system_clock::duration> age;
 };
 
+/**
+ * Validators of a stored resource, sent back so that the body is only sent again if it changed.
+ */
+struct cache_validators {
+	std::string etag;
+	std::string last_modified;
+
+	bool empty() const noexcept {
+		return etag.empty() && last_modified.empty();
+	}
+};
+
 struct rest_resource {
-	std::vector<std::byte> data;
+	/* Taken over from the HTTP response without a copy */
+	std::string            body;
 	cache_settings         cache_control;
+	cache_validators       validators;
+	/* Answer to a conditional request, the stored copy is still good and the body is empty */
+	bool                   not_modified = false;
+
+	std::span<const std::byte> data() const noexcept {
+		return std::as_bytes(std::span{body});
+	}
 };
 
 class api_handler {
 public:
 	using async_request = dpp::coroutine<std::variant<rest_resource, dpp::error_info>>;
 
-	api_handler(dpp::cluster &cluster, std::string_view api_id, std::string_view api_token);
+	/**
+	 * How failed requests are retried: only for statuses that can succeed later, with decorrelated jitter between attempts.
+	 */
+	struct retry_policy {
+		size_t max_attempts = 4;
+		app_duration base_delay = 200ms;
+		app_duration max_delay = 10s;
+		/* Past this since the request was made, no more attempts are started */
+		app_duration deadline = 30s;
+	};
+
+	/**
+	 * Bounds on the requests waiting for the API, past which they are refused with overloaded_exception according to the policy.
+	 */
+	struct queue_settings {
+		size_t max_in_flight = 32;
+		size_t max_waiting = 256;
+		overflow_policy policy = overflow_policy::shed;
+		/* Blizzard's quota, for each client */
+		size_t requests_per_second = 100;
+		size_t requests_per_hour = 36000;
+		/* Part of the slots and of the rate each priority is guaranteed when higher ones are busy */
+		lane_scheduler::shares min_share = lane_scheduler::default_min_share;
+		/* Relative share of each tenant when they compete, 1 when not listed */
+		std::unordered_map<tenant_id, double> tenant_weights;
+		/* Requests a tenant that had nothing waiting can get in a row */
+		size_t tenant_burst = 4;
+		retry_policy retry;
+		/* Duplicates of slow requests, off unless given a ratio */
+		hedging_policy::settings hedging;
+	};
+
+	/**
+	 * Where requests go, to point the bot at a stand-in server for testing.
+	 */
+	struct endpoints {
+		/* Replaces the scheme and host of the region URLs when not empty */
+		std::string api_base_url;
+		std::string oauth_url = std::string{token_manager::default_oauth_url};
+		/* When not empty, successful responses are saved there as fixtures for the stand-in server */
+		std::filesystem::path record_fixtures;
+	};
+
+	/**
+	 * @param clients Credentials to spread the requests over, each with its own token and quota
+	 */
+	api_handler(dpp::cluster &cluster, thread_pool &pool, timer_wheel &timers, std::vector<api_credentials> clients, queue_settings settings, endpoints targets);
 
 	dpp::coroutine<void> start();
 
-	async_request get(std::string_view path, std::string_view resource_namespace);
+	/**
+	 * GET a resource, higher priorities being served first, then tenants in turn. With validators the request is conditional, and a resource that didn't change comes back as not_modified.
+	 */
+	async_request get(std::string_view path, std::string_view resource_namespace, priority level = priority::normal, tenant_id tenant = 0, cache_validators conditional = {});
+
+	bool overloaded() const noexcept {
+		return _admission.overloaded();
+	}
+
+	/**
+	 * Requests waiting and in flight for each tenant.
+	 */
+	std::vector<admission_gate::tenant_usage> usage() const {
+		return _admission.usage();
+	}
 
 private:
-	dpp::coroutine<client_credentials> _request_access();
+	struct client {
+		client(dpp::cluster& cluster, timer_wheel& timers, api_credentials credentials, const queue_settings& settings, const std::string& oauth_url);
+
+		token_manager tokens;
+		rate_limiter limiter;
+	};
+
+	/**
+	 * Client with the most quota left.
+	 */
+	client& _pick_client();
+
+	async_request _queue(std::string_view path, std::string_view resource_namespace, priority level, tenant_id tenant, cache_validators conditional);
+
+	/**
+	 * One attempt, hedged if it is slower than usual for its endpoint.
+	 */
+	async_request _send(client& sender, std::string_view path, std::string_view resource_namespace, priority level, const cache_validators& conditional);
 
-	async_request _queue(std::string_view path, std::string_view resource_namespace);
+	async_request _do_request(client& sender, dpp::http_method method, std::string_view path, std::string_view resource_namespace, const cache_validators& conditional);
 
-	async_request _do_request(dpp::http_method method, std::string_view path, std::string_view resource_namespace);
+	void _record(std::string_view url, std::string_view resource_namespace, std::string_view body) const;
 
 	dpp::cluster& _cluster;
-	std::mutex _queue_mutex;
-	std::shared_mutex _requests_mutex;
-	std::shared_mutex _credentials_mutex;
-	std::queue<app_timestamp> _requests_last_hour;
-	std::queue<app_timestamp> _requests_last_second;
-	std::queue<dpp::promise<void>*> _requests_queue;
-	std::string_view _api_id;
-	std::string_view _api_token;
-	client_credentials _api_credentials;
+	timer_wheel& _timers;
+	retry_policy _retry;
+	endpoints _endpoints;
+	std::vector<std::unique_ptr<client>> _clients;
+	admission_gate _admission;
+	hedging_policy _hedging;
 };
 
 }
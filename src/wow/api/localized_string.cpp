@@ -1,34 +1,63 @@
 #include "localized_string.h"
 
-namespace mimiron::wow {
+#include <atomic>
+#include <limits>
 
+namespace mimiron::wow {
 
 namespace {
 
-template <size_t N>
-std::string find_locale(const dpp::json& json) {
-	if (auto it = json.find(locales[N].code); it != json.end()) {
-		return *it;
+using locale_mask = localized_string::locale_mask;
+
+static_assert(locales.size() <= std::numeric_limits<locale_mask>::digits);
+
+std::atomic<locale_mask> kept_mask = (locale_mask{1} << locales.size()) - 1;
+
+localized_string::offset_t end_offset(const std::string& buffer) {
+	if (buffer.size() > std::numeric_limits<localized_string::offset_t>::max()) {
+		throw locale_exception{"localized string too long"};
 	}
-	return {};
-};
+	return static_cast<localized_string::offset_t>(buffer.size());
+}
+
+}
 
-template <size_t... Ns>
-std::array<std::string, sizeof...(Ns)> find_locales(const dpp::json& json, std::index_sequence<Ns...>) {
-	return {find_locale<Ns>(json)...};
+void localized_string::keep_locales(std::span<const locale> kept) noexcept {
+	locale_mask mask = 0;
+
+	for (locale loc : kept) {
+		if (std::to_underlying(loc) < std::to_underlying(locale::count)) {
+			mask |= locale_mask{1} << std::to_underlying(loc);
+		}
+	}
+	kept_mask.store(mask, std::memory_order_relaxed);
 }
 
+auto localized_string::kept_locales() noexcept -> locale_mask {
+	return kept_mask.load(std::memory_order_relaxed);
 }
 
 localized_string localized_string::from_json(const dpp::json& j) {
+	localized_string ret;
+
 	if (j.is_string()) {
-		auto ret = localized_string{};
-		ret.values[0] = j;
+		ret.buffer = j.get<std::string>();
+		ret.ends.fill(end_offset(ret.buffer));
 		return ret;
 	}
-	return {.values = find_locales(j, std::make_index_sequence<locales.size()>{})};
-}
 
-}
+	locale_mask kept = kept_locales();
 
+	for (size_t i = 0; i < locales.size(); ++i) {
+		if (kept & (locale_mask{1} << i)) {
+			if (auto it = j.find(locales[i].code); it != j.end() && it->is_string()) {
+				ret.buffer += it->get_ref<const std::string&>();
+			}
+		}
+		ret.ends[i] = end_offset(ret.buffer);
+	}
+	ret.buffer.shrink_to_fit();
+	return ret;
+}
 
+}
@@ -4,10 +4,13 @@
 #include <string>
 #include <string_view>
 #include <array>
+#include <cstdint>
+#include <span>
 
 #include <dpp/json.h>
 
 #include "exception.h"
+#include "tools/perfect_hash.h"
 
 namespace mimiron::wow {
 
@@ -61,13 +64,68 @@ inline constexpr auto locales = std::to_array<locale_info, std::to_underlying(lo
 
 inline constexpr locale_info unknown_locale = {"unknown", u8"unknown", u8"unknown"};
 
+namespace detail {
+
+inline constexpr perfect_hash locale_codes{[] {
+	std::array<std::string_view, locales.size()> codes;
+
+	std::ranges::transform(locales, codes.begin(), &locale_info::code);
+	return codes;
+}()};
+
+}
+
+/**
+ * Locale of a code like "en_US", unknown if there is none.
+ */
+constexpr locale to_locale(std::string_view code) noexcept {
+	size_t index = detail::locale_codes.find(code);
+
+	return index == detail::locale_codes.npos ? locale::unknown : static_cast<locale>(index);
+}
+
+/**
+ * String in every kept locale, or in one when fetched for a single locale. That one is then returned whatever the locale asked,
+ * as is the first one present for a locale that is missing.
+ *
+ * The strings are stored back to back in one buffer, in the order of `locales`.
+ */
 struct localized_string {
+	using offset_t = uint16_t;
+	/* Bit i set for locales[i] */
+	using locale_mask = uint32_t;
+
 	static localized_string from_json(dpp::json const& j);
 
+	/**
+	 * Locales from_json keeps, the others are dropped. All of them by default; set at startup, before anything is parsed.
+	 */
+	static void keep_locales(std::span<const locale> kept) noexcept;
+
+	/**
+	 * Mask of the locales from_json keeps, stored objects parsed under another mask are not to be used.
+	 */
+	static locale_mask kept_locales() noexcept;
+
 	constexpr std::string_view operator[](locale loc) const noexcept;
 	constexpr std::string_view operator[](std::string_view loc) const;
 
-	std::array<std::string, locales.size()> values;
+	std::string buffer;
+	/* Where each locale's string ends in the buffer, the single string form is the first one */
+	std::array<offset_t, locales.size()> ends{};
+
+private:
+	constexpr std::string_view _get(size_t index) const noexcept {
+		size_t begin = index == 0 ? 0 : ends[index - 1];
+
+		if (begin == ends[index]) {
+			/* Everything before the first string present is empty, so it starts the buffer */
+			auto first = std::ranges::find_if(ends, [](offset_t end) { return end != 0; });
+
+			return std::string_view{buffer}.substr(0, first == ends.end() ? 0 : *first);
+		}
+		return std::string_view{buffer}.substr(begin, ends[index] - begin);
+	}
 };
 
 class locale_exception : public exception {
@@ -75,18 +133,18 @@ class locale_exception : public exception {
 };
 
 constexpr std::string_view localized_string::operator[](locale loc) const noexcept {
-	assert(std::to_underlying(loc) < values.size());
+	assert(std::to_underlying(loc) < ends.size());
 
-	return values[std::to_underlying(loc)];
+	return _get(std::to_underlying(loc));
 }
 
 constexpr std::string_view localized_string::operator[](std::string_view loc) const {
-	auto it = std::ranges::find(locales, loc, &locale_info::code);
+	locale found = to_locale(loc);
 
-	if (it == locales.end()) {
+	if (found == locale::unknown) {
 		throw locale_exception{"invalid locale " + std::string{loc}};
 	}
-	return values[it - locales.begin()];
+	return _get(std::to_underlying(found));
 }
 
 }
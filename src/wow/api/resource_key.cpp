@@ -0,0 +1,97 @@
+#include "wow/api/resource_key.h"
+
+#include <charconv>
+#include <deque>
+#include <format>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace mimiron::wow {
+
+namespace {
+
+/**
+ * Every slug ever used in a key, never freed: there are only so many realms and such.
+ */
+class slug_table {
+public:
+	uint64_t intern(std::string_view slug) {
+		{
+			std::shared_lock lock{_mutex};
+
+			if (auto it = _ids.find(slug); it != _ids.end()) {
+				return it->second;
+			}
+		}
+		std::unique_lock lock{_mutex};
+
+		if (auto it = _ids.find(slug); it != _ids.end()) {
+			return it->second;
+		}
+		uint64_t id = _slugs.size();
+
+		/* The map's keys point into the deque, which doesn't move its elements */
+		_ids.emplace(_slugs.emplace_back(slug), id);
+		return id;
+	}
+
+	std::string slug(uint64_t id) const {
+		std::shared_lock lock{_mutex};
+
+		return _slugs.at(id);
+	}
+
+private:
+	mutable std::shared_mutex _mutex;
+	std::deque<std::string> _slugs;
+	std::unordered_map<std::string_view, uint64_t> _ids;
+};
+
+slug_table slugs;
+
+/* Only canonical numbers, "012" stays a slug so that keys map back to the same name */
+std::optional<uint64_t> parse_id(std::string_view name) noexcept {
+	uint64_t id;
+
+	if (name.empty() || (name.size() > 1 && name.front() == '0')) {
+		return std::nullopt;
+	}
+	auto [end, err] = std::from_chars(name.data(), name.data() + name.size(), id);
+
+	if (err != std::errc{} || end != name.data() + name.size()) {
+		return std::nullopt;
+	}
+	return id;
+}
+
+}
+
+resource_key resource_key::of(const resource_location& location, api_namespace ns, std::string_view name) {
+	std::optional<uint64_t> id = parse_id(name);
+
+	return {
+		.name = id ? *id : slugs.intern(name),
+		.version = location.version,
+		.ns = ns,
+		.language = location.language.value_or(locale::unknown),
+		.region = static_cast<uint8_t>(region_index(location.region_code)),
+		.numeric = id.has_value()
+	};
+}
+
+std::string_view resource_key::namespace_name() const noexcept {
+	return namespace_of(region, version, ns);
+}
+
+std::string to_string(const resource_key& key) {
+	std::string name = key.numeric ? std::to_string(key.name) : slugs.slug(key.name);
+
+	if (key.language == locale::unknown) {
+		return std::format("{}:{}", key.namespace_name(), name);
+	}
+	return std::format("{}:{}@{}", key.namespace_name(), name, locales[std::to_underlying(key.language)].code);
+}
+
+}
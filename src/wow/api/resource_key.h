@@ -0,0 +1,56 @@
+#ifndef MIMIRON_WOW_API_RESOURCE_KEY_H_
+#define MIMIRON_WOW_API_RESOURCE_KEY_H_
+
+#include <compare>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "wow/api/wow_api.h"
+
+namespace mimiron::wow {
+
+/**
+ * Identifies a resource in the caches without formatting a string: where it is fetched from, and its numeric id or slug.
+ * Slugs are interned, so that keys are compared and hashed as a few integers.
+ */
+struct resource_key {
+	/* Id when numeric, interned slug otherwise */
+	uint64_t name;
+	game_version version;
+	api_namespace ns;
+	/* locale::unknown for resources in every locale */
+	locale language;
+	/* Position in api_regions::all */
+	uint8_t region;
+	bool numeric;
+
+	static resource_key of(const resource_location& location, api_namespace ns, std::string_view name);
+
+	std::string_view namespace_name() const noexcept;
+
+	friend constexpr auto operator<=>(const resource_key&, const resource_key&) noexcept = default;
+};
+
+struct resource_key_hash {
+	size_t operator()(const resource_key& key) const noexcept {
+		uint64_t where = key.region
+			| static_cast<uint64_t>(std::to_underlying(key.version)) << 8
+			| static_cast<uint64_t>(std::to_underlying(key.ns)) << 16
+			| static_cast<uint64_t>(std::to_underlying(key.language)) << 24
+			| static_cast<uint64_t>(key.numeric) << 32;
+
+		return std::hash<uint64_t>{}(where ^ (key.name * 0x9e3779b97f4a7c15ull));
+	}
+};
+
+/**
+ * Like "dynamic-eu:argent-dawn@fr_FR", for logs.
+ */
+std::string to_string(const resource_key& key);
+
+}
+
+#endif /* MIMIRON_WOW_API_RESOURCE_KEY_H_ */
@@ -3,12 +3,15 @@
 #include <source_location>
 #include <fstream>
 #include <chrono>
+#include <thread>
+#include <tuple>
 
 #include "exception.h"
 
+#include "localized_string.h"
 #include "realm.h"
 #include "region.h"
-#include "tools/parse_json.h"
+#include "tools/json_stream.h"
 
 namespace mimiron::wow {
 
@@ -24,7 +27,13 @@ struct disk_resource {
 	file_time last_updated;
 	file_time expiration_time;
 	uint64_t build;
-	std::variant<std::monostate, T, std::vector<std::byte>> data;
+	cache_validators validators;
+	/* Parsed object, or the json when it couldn't be parsed */
+	std::variant<std::monostate, T, std::string> data;
+
+	bool expired() const noexcept {
+		return expiration_time != file_time::max() && expiration_time <= std::chrono::file_clock::now();
+	}
 };
 
 enum cache_resource_type {
@@ -33,6 +42,17 @@ enum cache_resource_type {
 	table
 };
 
+/**
+ * 0: header then data
+ * 1: header, then the ETag and Last-Modified validators as null-terminated strings, then data
+ * 2: same as 1, localized strings are one buffer and their end offsets instead of a string per locale
+ * 3: same as 2, the header records the locales kept in the localized strings of a parsed object
+ */
+constexpr inline uint64_t current_cache_format = 3;
+
+/* Parsed objects stored before this can't be read anymore, stored json still can */
+constexpr inline uint64_t min_object_cache_format = 3;
+
 struct cache_file_header {
 	std::array<char, 8> magic_number;
 	uint64_t cache_format{};
@@ -40,6 +60,7 @@ struct cache_file_header {
 	seconds valid_for{};
 	cache_resource_type type;
 	uint64_t build;
+	localized_string::locale_mask kept_locales{};
 };
 
 constexpr inline auto zero = std::array<char, 128>{};
@@ -237,6 +258,9 @@ inline constexpr serializer_t<std::remove_cvref_t<T>> serialize;
 template <typename T>
 class disk_cache {
 public:
+	/**
+	 * Expired resources are returned too, they can still be revalidated.
+	 */
 	auto load(const resource_location& location, std::string_view name) -> std::optional<disk_resource<T>>;
 	void save(const resource_location& location, const disk_resource<T>& resource, std::string_view name);
 	void remove(const resource_location& location, std::string_view name);
@@ -268,10 +292,20 @@ constexpr auto resource_folder<std::vector<realm_entry>> = string_literal{"/real
 template <typename T>
 std::shared_mutex disk_mutex;
 
+/**
+ * Suffix of the resources fetched for a single locale, empty for the ones in every locale.
+ */
+std::string locale_suffix(const resource_location& location, char separator) {
+	if (!location.language) {
+		return {};
+	}
+	return separator + std::string{locales[std::to_underlying(*location.language)].code};
+}
+
 template <typename T>
 auto get_path = [](const resource_location& location, std::string_view name) -> stdfs::path {
-	static constexpr auto path = string_literal{"data/blizzard/{}/{}"} + resource_folder<realm> + string_literal{"/{}"};
-	return {std::format(path.str, std::string_view{location.region_code}, std::to_underlying(location.version), name)};
+	static constexpr auto path = string_literal{"data/blizzard/{}/{}{}"} + resource_folder<realm> + string_literal{"/{}"};
+	return {std::format(path.str, std::string_view{location.region_code}, std::to_underlying(location.version), locale_suffix(location, '/'), name)};
 };
 
 template <typename T>
@@ -296,23 +330,30 @@ auto disk_cache<T>::load(const resource_location& location, std::string_view nam
 	
 	fs.seekg(0, std::ios::beg);
 	serialize<cache_file_header>.out(fs, header);
-	file_time expiration_time = header.last_updated + header.valid_for;
-	if (expiration_time != expiration_time.max() && expiration_time <= std::chrono::file_clock::now()) {
+	if (std::memcmp(header.magic_number.data(), "mimiron~", 8) != 0 || header.cache_format > current_cache_format) {
 		return std::nullopt;
 	}
 
-	if (std::memcmp(header.magic_number.data(), "mimiron~", 8) != 0 || header.cache_format > 0) {
-		return std::nullopt;
-	}
+	file_time expiration_time = header.last_updated + header.valid_for;
+	cache_validators validators;
 
 	fs.seekg(128, std::ios::beg);
+	if (header.cache_format >= 1) {
+		std::getline(fs, validators.etag, char{0});
+		std::getline(fs, validators.last_modified, char{0});
+	}
 
 	switch (header.type) {
 		case resource: {
+			/* Its localized strings lack the locales kept since it was stored, or hold some that are no longer */
+			if (header.cache_format < min_object_cache_format || header.kept_locales != localized_string::kept_locales()) {
+				return std::nullopt;
+			}
 			disk_resource<T> resource {
 				.last_updated = header.last_updated,
 				.expiration_time = expiration_time,
-				.build = header.build
+				.build = header.build,
+				.validators = std::move(validators)
 			};
 			resource.data.template emplace<T>();
 			serialize<T>.out(fs, std::get<T>(resource.data));
@@ -323,20 +364,15 @@ auto disk_cache<T>::load(const resource_location& location, std::string_view nam
 			disk_resource<T> resource {
 				.last_updated = header.last_updated,
 				.expiration_time = expiration_time,
-				.build = header.build
+				.build = header.build,
+				.validators = std::move(validators)
 			};
 
-			std::vector<std::byte> &vec = resource.data.template emplace<std::vector<std::byte>>();
-			vec.reserve(file_size - 128);
-			char buf[1024];
-			while (fs.good()) {
-				fs.read(buf, 1024);
-				auto sz = static_cast<size_t>(fs.gcount());
-				vec.append_range(std::span{reinterpret_cast<std::byte*>(buf), sz});
-				if (sz < 1024) {
-					break;
-				}
-			}
+			std::string &body = resource.data.template emplace<std::string>();
+			body.resize_and_overwrite(file_size - static_cast<size_t>(fs.tellg()), [&fs](char* buf, size_t size) {
+				fs.read(buf, static_cast<std::streamsize>(size));
+				return static_cast<size_t>(fs.gcount());
+			});
 
 			return resource;
 		}
@@ -364,19 +400,24 @@ void disk_cache<T>::save(const resource_location& location, const disk_resource<
 
 	cache_file_header header {
 		.magic_number = {'m', 'i', 'm', 'i', 'r', 'o', 'n', '~'},
-		.cache_format = 0,
+		.cache_format = current_cache_format,
 		.last_updated = resource.last_updated,
 		.valid_for = std::chrono::floor<seconds>(resource.expiration_time - resource.last_updated),
-		.type = std::holds_alternative<std::vector<std::byte>>(resource.data) ? json : cache_resource_type::resource,
-		.build = 0
+		.type = std::holds_alternative<std::string>(resource.data) ? json : cache_resource_type::resource,
+		.build = 0,
+		.kept_locales = localized_string::kept_locales()
 	};
 
 	serialize<cache_file_header>.in(fs, header);
 	std::streampos pos = fs.tellp();
 	fs.write(zero.data(), 128 - pos);
+	fs.write(resource.validators.etag.data(), resource.validators.etag.size());
+	fs.put(0);
+	fs.write(resource.validators.last_modified.data(), resource.validators.last_modified.size());
+	fs.put(0);
 
-	if (auto const* data = std::get_if<std::vector<std::byte>>(&resource.data); data != nullptr) {
-		fs.write(reinterpret_cast<char const*>(data->data()), data->size());
+	if (auto const* body = std::get_if<std::string>(&resource.data); body != nullptr) {
+		fs.write(body->data(), static_cast<std::streamsize>(body->size()));
 		return;
 	}
 
@@ -390,13 +431,13 @@ using promise = dpp::promise<T>;
 
 template <typename T>
 class promise_cache {
-	using value_t = std::pair<std::string, promise<T>>;
+	using value_t = std::pair<resource_key, promise<T>>;
 public:
-	std::optional<dpp::awaitable<T>> emplace(std::string key) {
+	std::optional<dpp::awaitable<T>> emplace(const resource_key& key) {
 		std::lock_guard lock{mutex};
 
 		auto [begin, end] = std::ranges::equal_range(promises, key, std::less{}, &value_t::first);
-		auto it = promises.emplace(end, std::move(key), promise<T>{});
+		auto it = promises.emplace(end, key, promise<T>{});
 
 		if (begin == end) {
 			return std::nullopt;
@@ -405,7 +446,7 @@ public:
 	}
 
 	template <typename U>
-	void fulfill(std::string_view key, U&& value) {
+	void fulfill(const resource_key& key, U&& value) {
 		std::unique_lock lock{mutex};
 
 		auto eq_range = std::ranges::equal_range(promises, key, std::less{}, &value_t::first);
@@ -430,7 +471,7 @@ public:
 
 private:
 	std::mutex mutex;
-	std::vector<std::pair<std::string, dpp::promise<T>>> promises;
+	std::vector<value_t> promises;
 };
 
 template <typename T>
@@ -443,48 +484,7 @@ template <typename T>
 std::shared_mutex s_cache_mutex;
 
 template <typename T>
-cache<std::string, T, std::hash<std::string_view>> s_resource_cache;
-
-constexpr fixed_string<32> location_str(resource_location const& loc, api_namespace n) noexcept {
-	fixed_string<32> ret;
-	fixed_string<32>::iterator_t it = ret.begin();
-
-	switch (n) {
-		case api_static:
-			it = std::copy_n("static", 6, it);
-			break;
-
-		case api_dynamic:
-			it = std::copy_n("dynamic", 7, it);
-			break;
-
-		case api_profile:
-			it = std::copy_n("profile", 7, it);
-			break;
-	}
-
-	switch (loc.version) {
-		case retail:
-			break;
-
-		case progression:
-			it = std::copy_n("-classic", 8, it);
-			break;
-
-		case classic_era:
-			it = std::copy_n("-classic1x", 10, it);
-			break;
-	}
-	*it = '-';
-	++it;
-	*it = loc.region_code[0];
-	++it;
-	*it = loc.region_code[1];
-	++it;
-	ret.str_size = std::distance(ret.begin(), it);
-	std::fill(it, ret.str.end(), 0);
-	return {ret};
-}
+cache<resource_key, T, resource_key_hash> s_resource_cache;
 
 template <typename T>
 struct resource_api_info {
@@ -512,12 +512,177 @@ auto resource_info<std::vector<realm_entry>> = resource_api_info<std::vector<rea
 	"realms"
 };
 
+/* Expired resources older than this are not served while revalidating */
+constexpr auto stale_limit = std::chrono::duration_cast<file_duration>(24h);
+/* Hits between two fetches for a resource to be refreshed ahead of its expiry */
+constexpr uint32_t hot_threshold = 3;
+/* Refresh ahead this long before expiry at most, a tenth of the remaining lifetime at least */
+constexpr auto max_refresh_lead = std::chrono::duration_cast<file_duration>(5min);
+
+/**
+ * Expiry and popularity of the resources in memory, for stale-while-revalidate and refresh-ahead.
+ */
+template <typename T>
+class freshness_table {
+public:
+	/**
+	 * Count a hit, returns whether the value is stale.
+	 */
+	bool touch(const resource_key& key) {
+		std::scoped_lock lock{_mutex};
+		entry& e = _entries[key];
+
+		++e.hits;
+		return e.expiration_time != file_time::max() && e.expiration_time <= std::chrono::file_clock::now();
+	}
+
+	/**
+	 * Returns false if a refresh is already running.
+	 */
+	bool begin_refresh(const resource_key& key) {
+		std::scoped_lock lock{_mutex};
+
+		return !std::exchange(_entries[key].refreshing, true);
+	}
+
+	void end_refresh(const resource_key& key) {
+		std::scoped_lock lock{_mutex};
+
+		_entries[key].refreshing = false;
+	}
+
+	/**
+	 * Record a newly stored value, and arm its refresh-ahead timer.
+	 */
+	void stored(const resource_key& key, file_time expiration_time, timer_wheel& timers, timer_wheel::callback on_due) {
+		std::scoped_lock lock{_mutex};
+		entry& e = _entries[key];
+
+		if (e.refresh_timer) {
+			timers.cancel(e.refresh_timer);
+			e.refresh_timer = 0;
+		}
+		e.expiration_time = expiration_time;
+		e.hits = 0;
+		if (expiration_time == file_time::max()) {
+			return;
+		}
+		auto remaining = expiration_time - std::chrono::file_clock::now();
+
+		if (auto delay = remaining - std::min(remaining / 10, max_refresh_lead); delay > file_duration::zero()) {
+			e.refresh_timer = timers.schedule_after(std::chrono::duration_cast<app_duration>(delay), std::move(on_due));
+		}
+	}
+
+	/**
+	 * Called by the refresh-ahead timer, returns whether the key is hot enough to refresh, in which case it is marked as refreshing.
+	 */
+	bool due(const resource_key& key) {
+		std::scoped_lock lock{_mutex};
+		entry& e = _entries[key];
+
+		e.refresh_timer = 0;
+		if (e.hits < hot_threshold || e.refreshing) {
+			return false;
+		}
+		e.refreshing = true;
+		return true;
+	}
+
+	/**
+	 * Disarm every refresh-ahead timer.
+	 */
+	void cancel_timers(timer_wheel& timers) {
+		std::scoped_lock lock{_mutex};
+
+		for (auto& [key, e] : _entries) {
+			if (e.refresh_timer) {
+				timers.cancel(e.refresh_timer);
+				e.refresh_timer = 0;
+			}
+		}
+	}
+
+private:
+	struct entry {
+		file_time expiration_time = file_time::max();
+		uint32_t hits = 0;
+		bool refreshing = false;
+		timer_wheel::timer_id refresh_timer = 0;
+	};
+
+	std::mutex _mutex;
+	std::unordered_map<resource_key, entry, resource_key_hash> _entries;
+};
+
+template <typename T>
+resource_key cache_key(resource_location const& location, std::string_view name) {
+	return resource_key::of(location, resource_info<T>.ns, name);
+}
+
+template <typename T>
+void set_lifetime(disk_resource<T>& res, const rest_resource& response) {
+	res.last_updated = std::chrono::file_clock::now() - response.cache_control.age.value_or(file_duration::zero());
+	res.expiration_time = response.cache_control.max_age.has_value() ? res.last_updated + *response.cache_control.max_age : file_time::max();
+}
+
+/**
+ * Put a stored copy in the memory cache in place of any older value, parsing it if it was stored as json. Blocks.
+ */
+template <typename T>
+std::optional<cached_resource<resource_key, T>> cache_stored(dpp::cluster& cluster, const resource_key& key, disk_resource<T>& stored) {
+	if (auto const* body = std::get_if<std::string>(&stored.data); body != nullptr) {
+		try {
+			return s_resource_cache<T>.replace(key, parse_json_stream<T>(std::as_bytes(std::span{*body}), resource_info<T>.output_field));
+		} catch (const std::exception &e) {
+			cluster.log(dpp::ll_warning, "exception while parsing stored json for resource " + to_string(key) + ": " + e.what());
+		}
+	} else if (std::holds_alternative<T>(stored.data)) {
+		return s_resource_cache<T>.replace(key, std::move(std::get<T>(stored.data)));
+	}
+	return std::nullopt;
 }
 
-resource_manager::resource_manager(dpp::cluster& cluster, std::string_view api_id, std::string_view api_token) :
+}
+
+struct resource_manager::freshness_tables {
+	std::tuple<freshness_table<realm>, freshness_table<std::vector<realm_entry>>> tables;
+
+	template <typename T>
+	freshness_table<T>& of() noexcept {
+		return std::get<freshness_table<T>>(tables);
+	}
+
+	void cancel_timers(timer_wheel& timers) {
+		std::apply([&](auto&... table) {
+			(table.cancel_timers(timers), ...);
+		}, tables);
+	}
+};
+
+resource_manager::resource_manager(dpp::cluster& cluster, thread_pool& pool, timer_wheel& timers, std::vector<api_credentials> clients, api_handler::queue_settings queue, api_handler::endpoints targets) :
 	_cluster{cluster},
-	_api_handler{cluster, api_id, api_token} {
+	_pool{pool},
+	_timers{timers},
+	_api_handler{cluster, pool, timers, std::move(clients), queue, std::move(targets)},
+	_freshness{std::make_unique<freshness_tables>()} {
+	_self->manager = this;
+}
+
+resource_manager::~resource_manager() {
+	stop();
+}
 
+void resource_manager::stop() {
+	{
+		/* Timers that already fired see the manager gone once we have the lock */
+		std::unique_lock lock{_self->mutex};
+		_self->manager = nullptr;
+	}
+	_freshness->cancel_timers(_timers);
+	while (_refreshing.load() > 0) {
+		std::this_thread::yield();
+	}
 }
 
 dpp::coroutine<> resource_manager::start() {
@@ -525,93 +690,236 @@ dpp::coroutine<> resource_manager::start() {
 }
 
 template <typename T>
-auto resource_manager::_get(resource_location const& location, std::string name) -> coroutine<T> {
-	constexpr resource_api_info<T>& resource_inf = resource_info<T>;
+auto resource_manager::_get(resource_location const& location, std::string name, priority level, tenant_id tenant) -> coroutine<T> {
 	constexpr promise_cache<resource<T>>& promise_cache = s_promise_list<resource<T>>;
-	auto namespace_str = location_str(location, resource_inf.ns);
-	std::string cache_path = std::format("{}:{}", std::string_view{namespace_str}, name);
+	resource_key key = cache_key<T>(location, name);
 
-	std::optional<awaitable<T>> awaitable = promise_cache.emplace(cache_path);
+	std::optional<awaitable<T>> awaitable = promise_cache.emplace(key);
 	if (awaitable.has_value()) {
 		co_return co_await *awaitable;
 	}
 
 	auto do_thing = [&]() -> coroutine<T> {
-		if (auto resource = s_resource_cache<T>.find(name); resource) {
+		if (auto resource = s_resource_cache<T>.find(key); resource) {
+			/* Stale-while-revalidate: the caller gets what we have while a single refresh runs in the background */
+			if (_freshness->template of<T>().touch(key) && _freshness->template of<T>().begin_refresh(key)) {
+				_refresh<T>(location, name);
+			}
 			co_return resource;
 		}
 
-		if (std::optional<disk_resource<T>> disk_resource = s_disk_cache<T>.load(location, name); disk_resource) {
-			if (auto const* data = std::get_if<std::vector<std::byte>>(&disk_resource->data); data != nullptr) {
-				try {
-					auto [it, inserted] = s_resource_cache<T>.try_emplace(cache_path, parse_json<T>(nlohmann::json::parse(data->begin(), data->end())));
+		/* Reading and parsing the stored copy blocks, do it on the pool */
+		auto stored = co_await _pool.schedule([&]() -> std::optional<std::pair<resource<T>, file_time>> {
+			std::optional<disk_resource<T>> disk_resource = s_disk_cache<T>.load(location, name);
 
-					co_return it;
-				} catch (const std::exception &e) {
-					_cluster.log(dpp::ll_warning, "exception while parsing stored json for resource " + cache_path + ": " + e.what());
-				}
-			} else if (std::holds_alternative<T>(disk_resource->data)) {
-				auto [it, inserted] = s_resource_cache<T>.try_emplace(cache_path, std::move(std::get<T>(disk_resource->data)));
+			/* Past the stale limit the caller waits for a fresh copy rather than get one this old */
+			if (!disk_resource || (disk_resource->expired() && std::chrono::file_clock::now() - disk_resource->expiration_time > stale_limit)) {
+				return std::nullopt;
+			}
+			if (auto cached = cache_stored(_cluster, key, *disk_resource); cached) {
+				return std::pair{*std::move(cached), disk_resource->expiration_time};
+			}
+			return std::nullopt;
+		});
+		if (stored) {
+			auto& [cached, expiration_time] = *stored;
 
-				co_return it;
+			_track<T>(location, name, expiration_time);
+			if (expiration_time <= std::chrono::file_clock::now() && _freshness->template of<T>().begin_refresh(key)) {
+				_refresh<T>(location, name);
 			}
+			co_return std::move(cached);
 		}
-		std::variant<rest_resource, dpp::error_info> result = co_await _api_handler.get(location.host + resource_inf.path + name, namespace_str);
+		co_return co_await _fetch<T>(location, name, level, tenant);
+	};
+
+	try {
+		auto res = co_await do_thing();
+		promise_cache.fulfill(key, res);
+		co_return res;
+	} catch (...) {
+		promise_cache.fulfill(key, std::current_exception());
+		throw;
+	}
+}
+
+template <typename T>
+auto resource_manager::_fetch(resource_location const& location, std::string name, priority level, tenant_id tenant) -> coroutine<T> {
+	constexpr resource_api_info<T>& resource_inf = resource_info<T>;
+	resource_key key = cache_key<T>(location, name);
+
+	/* Blizzard answers with single strings instead of objects of every locale */
+	std::string url = location.host + resource_inf.path + name;
+	if (location.language) {
+		url += "?locale=";
+		url += locales[std::to_underlying(*location.language)].code;
+	}
+
+	auto fetch = [&](cache_validators conditional) -> dpp::coroutine<rest_resource> {
+		std::variant<rest_resource, dpp::error_info> result = co_await _api_handler.get(url, key.namespace_name(), level, tenant, std::move(conditional));
 
 		if (dpp::error_info const* info = std::get_if<1>(&result); info != nullptr) {
 			throw dpp::rest_exception{!info->human_readable.empty() ? info->human_readable : std::format("REST request produced HTTP error {}", info->code)};
 		}
+		co_return std::get<0>(std::move(result));
+	};
+
+	/* An expired copy is revalidated rather than downloaded and parsed again */
+	std::optional<disk_resource<T>> stored = co_await _pool.schedule([&]() {
+		return s_disk_cache<T>.load(location, name);
+	});
+	rest_resource response = co_await fetch(stored ? stored->validators : cache_validators{});
+
+	if (response.not_modified && stored) {
+		set_lifetime(*stored, response);
+		if (!response.validators.empty()) {
+			stored->validators = std::move(response.validators);
+		}
+		auto cached = co_await _pool.schedule([&]() -> std::optional<resource<T>> {
+			/* Saved before cache_stored moves the data out */
+			s_disk_cache<T>.save(location, *stored, name);
+			/* When revalidating what's in memory, keep the object we already parsed */
+			if (auto current = s_resource_cache<T>.find(key); current) {
+				return current;
+			}
+			return cache_stored(_cluster, key, *stored);
+		});
+		if (cached) {
+			_track<T>(location, name, stored->expiration_time);
+			co_return *std::move(cached);
+		}
+		/* The stored copy turned out unusable */
+		response = co_await fetch({});
+	}
 
-		rest_resource&   resource = std::get<0>(result);
-		disk_resource<T> res {
-			.last_updated = std::chrono::file_clock::now() - resource.cache_control.age.value_or(file_duration::zero()),
-			.expiration_time = resource.cache_control.max_age.has_value() ? res.last_updated + *resource.cache_control.max_age : file_time::max(),
-			.build = 0
-		};
+	disk_resource<T> res {
+		.build = 0,
+		.validators = std::move(response.validators)
+	};
 
+	set_lifetime(res, response);
+	auto fetched = co_await _pool.schedule([&]() -> resource_manager::resource<T> {
 		try {
-			nlohmann::json j = nlohmann::json::parse(resource.data.begin(), resource.data.end());
-			res.data.template emplace<T>(parse_json<T>(resource_inf.output_field == nullptr ? j : j[resource_inf.output_field]));
+			/* Parsed straight from the buffer, which can be kept or moved to the disk cache afterwards */
+			res.data.template emplace<T>(parse_json_stream<T>(response.data(), resource_inf.output_field));
 
-			auto [it, _] = s_resource_cache<T>.try_emplace(cache_path, std::get<T>(res.data));
+			/* Saved first so that the parsed object can be moved rather than copied into the cache */
 			s_disk_cache<T>.save(location, res, name);
-			co_return it;
+			return s_resource_cache<T>.replace(key, std::move(std::get<T>(res.data)));
 		} catch (const std::exception &e) {
-			_cluster.log(dpp::ll_warning, "exception while parsing received json for resource " + cache_path + ": " + e.what());
-			res.data.template emplace<std::vector<std::byte>>(std::move(resource.data));
+			_cluster.log(dpp::ll_warning, "exception while parsing received json for resource " + to_string(key) + ": " + e.what());
+			res.data.template emplace<std::string>(std::move(response.body));
 			s_disk_cache<T>.save(location, res, name);
 			throw;
 		} catch (...) {
-			_cluster.log(dpp::ll_warning, "exception while parsing received json for resource " + cache_path);
-			res.data.template emplace<std::vector<std::byte>>(std::move(resource.data));
+			_cluster.log(dpp::ll_warning, "exception while parsing received json for resource " + to_string(key));
+			res.data.template emplace<std::string>(std::move(response.body));
 			s_disk_cache<T>.save(location, res, name);
 			throw;
 		}
-	};
+	});
+	_track<T>(location, name, res.expiration_time);
+	co_return fetched;
+}
 
+template <typename T>
+dpp::job resource_manager::_refresh(resource_location location, std::string name) {
+	resource_key key = cache_key<T>(location, name);
+
+	/* Counted before the first suspension, stop() waits for the count to drop */
+	_refreshing.fetch_add(1);
 	try {
-		auto res = co_await do_thing();
-		promise_cache.fulfill(cache_path, res);
-		co_return res;
-	} catch (...) {
-		promise_cache.fulfill(cache_path, std::current_exception());
-		throw;
+		co_await _fetch<T>(location, name, priority::background, 0);
+	} catch (const std::exception &e) {
+		_cluster.log(dpp::ll_warning, "could not refresh resource " + to_string(key) + ": " + e.what());
+	}
+	_freshness->template of<T>().end_refresh(key);
+	/* Last use of the manager, it may be destroyed as soon as this is done */
+	_refreshing.fetch_sub(1);
+}
+
+template <typename T>
+void resource_manager::_track(resource_location const& location, const std::string& name, std::chrono::file_clock::time_point expiration_time) {
+	resource_key key = cache_key<T>(location, name);
+	std::shared_lock lock{_self->mutex};
+
+	/* A refresh finishing while stopping must not arm a timer stop() already went past */
+	if (!_self->manager) {
+		return;
+	}
+	_freshness->template of<T>().stored(key, expiration_time, _timers, [self = _self, location, name, key]() {
+		std::shared_lock lock{self->mutex};
+		resource_manager* manager = self->manager;
+
+		/* Refresh-ahead, only for the keys that were asked for since they were last fetched */
+		if (manager && manager->_freshness->template of<T>().due(key)) {
+			manager->_refresh<T>(location, name);
+		}
+	});
+}
+
+resource_location resource_manager::_localize(resource_location location) const {
+	if (!location.language) {
+		location.language = _locale;
 	}
+	return location;
 }
 
-auto resource_manager::get_realm(resource_location const& location, std::string name) -> coroutine<realm> {
-	co_return co_await _get<realm>(location, std::move(name));
+auto resource_manager::get_realm(resource_location const& location, std::string name, priority level, tenant_id tenant) -> coroutine<realm> {
+	co_return co_await _get<realm>(_localize(location), std::move(name), level, tenant);
 }
 
-auto resource_manager::get_realms(resource_location const& location) -> coroutine<std::vector<realm_entry>> {
-	co_return co_await _get<std::vector<realm_entry>>(location, "index");
+auto resource_manager::get_realms(resource_location const& location, priority level, tenant_id tenant) -> coroutine<std::vector<realm_entry>> {
+	co_return co_await _get<std::vector<realm_entry>>(_localize(location), "index", level, tenant);
 }
 
+template <typename T>
+auto resource_manager::get_many(resource_location const& location, std::vector<std::string> names, priority level, tenant_id tenant, fetch_callback<T> on_fetched, size_t concurrency) -> dpp::coroutine<std::vector<fetch_result<T>>> {
+	resource_location localized = _localize(location);
+	std::vector<fetch_result<T>> results(names.size());
+	std::atomic<size_t> next = 0;
+	std::mutex callback_mutex;
+
+	/* Each lane takes the next name as soon as it's done with the previous one */
+	auto lane = [&]() -> dpp::task<void> {
+		for (size_t i = next++; i < names.size(); i = next++) {
+			try {
+				results[i] = co_await _get<T>(localized, names[i], level, tenant);
+			} catch (...) {
+				results[i] = std::current_exception();
+			}
+			if (on_fetched) {
+				std::scoped_lock lock{callback_mutex};
+
+				on_fetched(i, results[i]);
+			}
+		}
+	};
+
+	size_t lane_count = std::min(std::max<size_t>(concurrency, 1), names.size());
+	std::vector<dpp::task<void>> lanes;
+
+	lanes.reserve(lane_count);
+	for (size_t i = 0; i < lane_count; ++i) {
+		lanes.push_back(lane());
+	}
+	for (dpp::task<void>& t : lanes) {
+		co_await t;
+	}
+	co_return results;
+}
+
+template auto resource_manager::get_many<realm>(resource_location const&, std::vector<std::string>, priority, tenant_id, fetch_callback<realm>, size_t) -> dpp::coroutine<std::vector<fetch_result<realm>>>;
+
 
 void resource_manager::set_disk_cache(stdfs::path path) noexcept {
 	_fs_path = std::move(path);
 }
 
+void resource_manager::set_locale(std::optional<locale> language) noexcept {
+	_locale = language;
+}
+
 stdfs::path const& resource_manager::disk_cache() const {
 	return _fs_path;
 }
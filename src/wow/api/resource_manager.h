@@ -4,11 +4,19 @@
 #include <dpp/cluster.h>
 #include <string_view>
 #include <shared_mutex>
+#include <memory>
+#include <atomic>
 #include <filesystem>
+#include <functional>
+#include <exception>
+#include <variant>
 
 #include "common.h"
 #include "wow/api/api_handler.h"
+#include "wow/api/resource_key.h"
 #include "tools/cache.h"
+#include "tools/thread_pool.h"
+#include "tools/timer_wheel.h"
 
 #include <unordered_map>
 
@@ -19,7 +27,7 @@ namespace stdfs = std::filesystem;
 class resource_manager {
 public:
 	template <typename T>
-	using resource = cached_resource<std::string, T>;
+	using resource = cached_resource<resource_key, T>;
 
 	template <typename T>
 	using awaitable = dpp::awaitable<resource<T>>;
@@ -27,28 +35,113 @@ public:
 	template <typename T>
 	using coroutine = dpp::coroutine<resource<T>>;
 
-	resource_manager(dpp::cluster &cluster, std::string_view api_id, std::string_view api_token);
+	/**
+	 * Outcome of one of the resources of get_many.
+	 */
+	template <typename T>
+	using fetch_result = std::variant<resource<T>, std::exception_ptr>;
+
+	/**
+	 * Called with the position of the resource in the request and its outcome, as soon as it is fetched.
+	 * Calls are never concurrent but can come from any thread.
+	 */
+	template <typename T>
+	using fetch_callback = std::function<void(size_t index, const fetch_result<T>& result)>;
+
+	static constexpr size_t default_bulk_concurrency = 16;
+
+	resource_manager(dpp::cluster &cluster, thread_pool &pool, timer_wheel &timers, std::vector<api_credentials> clients, api_handler::queue_settings queue = {}, api_handler::endpoints targets = {});
+
+	~resource_manager();
 
 	dpp::coroutine<void> start();
 
+	/**
+	 * Stop refreshing resources ahead of their expiry, and wait for the background refreshes under way.
+	 *
+	 * Called by the destructor. Refreshes need the thread pool to finish, an owner that stops the pool first must call this before.
+	 */
+	void stop();
+
+	bool overloaded() const noexcept {
+		return _api_handler.overloaded();
+	}
+
+	std::vector<admission_gate::tenant_usage> api_usage() const {
+		return _api_handler.usage();
+	}
+
 	void set_disk_cache(stdfs::path path) noexcept;
 	stdfs::path const& disk_cache() const;
 
-	coroutine<realm> get_realm(const resource_location& location, std::string name);
+	/**
+	 * Locale to fetch when a location doesn't ask for one, every locale when empty. Set before start().
+	 */
+	void set_locale(std::optional<locale> language) noexcept;
+
+	/**
+	 * `tenant` is the Discord guild the request is made for, sharing the API quota fairly between guilds.
+	 */
+	coroutine<realm> get_realm(const resource_location& location, std::string name, priority level = priority::normal, tenant_id tenant = 0);
 	//coroutine<realm> get_realm(const resource_location& location, int64_t id);
 
-	coroutine<std::vector<realm_entry>> get_realms(const resource_location& location);
+	coroutine<std::vector<realm_entry>> get_realms(const resource_location& location, priority level = priority::normal, tenant_id tenant = 0);
+
+	/**
+	 * Fetch many resources at once, with at most `concurrency` of them in flight.
+	 *
+	 * Each goes through the caches and single-flight path of a single get. Errors are reported per resource rather than thrown,
+	 * and the results are returned in the order of `names` once they are all in.
+	 */
+	template <typename T>
+	dpp::coroutine<std::vector<fetch_result<T>>> get_many(const resource_location& location, std::vector<std::string> names, priority level = priority::normal, tenant_id tenant = 0, fetch_callback<T> on_fetched = {}, size_t concurrency = default_bulk_concurrency);
 
 private:
+	resource_location _localize(resource_location location) const;
+
 	template <typename T>
-	coroutine<T> _get(const resource_location& location, std::string name);
+	coroutine<T> _get(const resource_location& location, std::string name, priority level, tenant_id tenant);
 
 	template <typename T>
 	coroutine<T> _get(const resource_location& location, int64_t id);
 
+	/**
+	 * Request the resource, revalidating the stored copy if there is one, and replace it in the caches.
+	 */
+	template <typename T>
+	coroutine<T> _fetch(const resource_location& location, std::string name, priority level, tenant_id tenant);
+
+	template <typename T>
+	dpp::job _refresh(resource_location location, std::string name);
+
+	/**
+	 * Record the expiry of a resource that was just put in memory, and schedule its refresh-ahead.
+	 */
+	template <typename T>
+	void _track(const resource_location& location, const std::string& name, std::chrono::file_clock::time_point expiration_time);
+
+	/**
+	 * Expiry and popularity of the resources in memory, one table per resource type.
+	 */
+	struct freshness_tables;
+
+	/**
+	 * Shared with the refresh-ahead timers, which may fire after the manager is gone.
+	 */
+	struct self_handle {
+		std::shared_mutex mutex;
+		resource_manager* manager = nullptr;
+	};
+
 	dpp::cluster& _cluster;
+	thread_pool& _pool;
+	timer_wheel& _timers;
 	api_handler _api_handler;
 	std::filesystem::path _fs_path;
+	std::optional<locale> _locale;
+	std::unique_ptr<freshness_tables> _freshness;
+	std::shared_ptr<self_handle> _self = std::make_shared<self_handle>();
+	std::atomic<size_t> _refreshing = 0;
 };
 
 }
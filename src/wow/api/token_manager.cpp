@@ -0,0 +1,106 @@
+#include "token_manager.h"
+
+#include <optional>
+
+#include "tools/parse_json.h"
+
+namespace mimiron::wow {
+
+token_manager::token_manager(dpp::cluster& cluster, timer_wheel& timers, api_credentials credentials, std::string oauth_url) :
+	_cluster{cluster},
+	_timers{timers},
+	_credentials{std::move(credentials)},
+	_oauth_url{std::move(oauth_url)}
+{
+	_self->manager = this;
+}
+
+token_manager::~token_manager() {
+	{
+		/* Waits for a timer or a renewal using the manager right now, the ones after that find it gone */
+		std::unique_lock lock{_self->mutex};
+
+		_self->manager = nullptr;
+	}
+	if (auto timer = _refresh_timer.exchange(0); timer) {
+		_timers.cancel(timer);
+	}
+}
+
+dpp::coroutine<> token_manager::start() {
+	auto requested_at = app_clock::now();
+
+	_publish(co_await _request_access(_cluster, _credentials, _oauth_url), requested_at);
+}
+
+dpp::coroutine<client_credentials> token_manager::_request_access(dpp::cluster& cluster, api_credentials credentials, std::string oauth_url) {
+	cluster.log(dpp::ll_info, std::format("querying the WoW API for an authorization token for client {}...", credentials.id));
+	std::string auth = std::format("{}:{}", credentials.id, credentials.secret);
+	dpp::promise<dpp::http_request_completion_t> p;
+	cluster.request(
+		oauth_url, dpp::m_post,
+		[&] (const dpp::http_request_completion_t& result) { p.set_value(result); },
+		"grant_type=client_credentials",
+		"application/x-www-form-urlencoded", {
+			{"Authorization", "Basic " + dpp::base64_encode(reinterpret_cast<unsigned char*>(auth.data()), static_cast<uint32_t>(auth.size()))}
+		},
+		"1.0"
+	);
+	auto result = co_await p.get_awaitable();
+	if (result.status >= 300) {
+		throw dpp::rest_exception{"bad wow api credentials"};
+	}
+	auto access = parse_json<client_credentials>(nlohmann::json::parse(result.body));
+
+	cluster.log(dpp::ll_info, std::format("WoW API authorization token obtained, expires in {}", std::chrono::hh_mm_ss{seconds{access.expires_in}}));
+	co_return access;
+}
+
+void token_manager::_publish(const client_credentials& credentials, app_timestamp requested_at) {
+	/* expires_in counts from when the server answered, starting from the request errs on the safe side */
+	app_duration lifetime = seconds{credentials.expires_in};
+
+	_current.store(std::make_shared<const access_token>(credentials.access_token, requested_at + lifetime), std::memory_order_release);
+	_schedule_refresh(std::max(lifetime - refresh_margin, lifetime / 2) - (app_clock::now() - requested_at));
+}
+
+void token_manager::_schedule_refresh(app_duration delay) {
+	_refresh_timer = _timers.schedule_after(delay, [self = _self] {
+		std::shared_lock lock{self->mutex};
+
+		if (token_manager* manager = self->manager) {
+			manager->_refresh_timer = 0;
+			_refresh(self, manager->_cluster, manager->_credentials, manager->_oauth_url);
+		}
+	});
+}
+
+dpp::job token_manager::_refresh(std::shared_ptr<self_handle> self, dpp::cluster& cluster, api_credentials credentials, std::string oauth_url) {
+	auto requested_at = app_clock::now();
+	std::optional<client_credentials> renewed;
+	std::string error;
+
+	try {
+		renewed = co_await _request_access(cluster, std::move(credentials), std::move(oauth_url));
+	} catch (const std::exception& e) {
+		error = e.what();
+	}
+
+	std::shared_lock lock{self->mutex};
+	token_manager* manager = self->manager;
+
+	if (!manager) {
+		co_return;
+	}
+	if (renewed) {
+		manager->_publish(*renewed, requested_at);
+		co_return;
+	}
+	auto token = manager->current();
+	auto left = token ? std::chrono::duration_cast<seconds>(token->expires_at - app_clock::now()) : seconds{0};
+
+	cluster.log(dpp::ll_error, std::format("could not renew the WoW API token, retrying in {} ({} left on the current one): {}", std::chrono::duration_cast<seconds>(retry_delay), left, error));
+	manager->_schedule_refresh(retry_delay);
+}
+
+}
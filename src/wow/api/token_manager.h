@@ -0,0 +1,93 @@
+#ifndef MIMIRON_WOW_API_TOKEN_MANAGER_H_
+#define MIMIRON_WOW_API_TOKEN_MANAGER_H_
+
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+
+#include <dpp/cluster.h>
+#include <dpp/coro/coroutine.h>
+
+#include "common.h"
+#include "tools/timer_wheel.h"
+#include "wow/api/wow_api.h"
+
+namespace mimiron::wow {
+
+/**
+ * Client id and secret of a Battle.net API client, each client has its own quota.
+ */
+struct api_credentials {
+	std::string id;
+	std::string secret;
+};
+
+/**
+ * Keeps an OAuth token for the Battle.net API, renewed in the background before it expires.
+ *
+ * Requests read the current token without locking and never wait for a renewal; if one fails the old token
+ * is kept until it runs out and the renewal is retried.
+ */
+class token_manager {
+public:
+	struct access_token {
+		std::string bearer;
+		app_timestamp expires_at;
+	};
+
+	/* Renew this long before expiry, or halfway through the token's lifetime if it is shorter than twice this */
+	static constexpr app_duration refresh_margin = 5min;
+	static constexpr app_duration retry_delay = 30s;
+
+	static constexpr std::string_view default_oauth_url = "https://oauth.battle.net/token";
+
+	token_manager(dpp::cluster &cluster, timer_wheel &timers, api_credentials credentials, std::string oauth_url = std::string{default_oauth_url});
+	~token_manager();
+
+	token_manager(const token_manager&) = delete;
+	token_manager& operator=(const token_manager&) = delete;
+
+	/**
+	 * Obtain the first token, and start renewing it.
+	 *
+	 * @throws dpp::rest_exception if the credentials are refused
+	 */
+	dpp::coroutine<void> start();
+
+	/**
+	 * Current token, null before start() completes.
+	 */
+	std::shared_ptr<const access_token> current() const noexcept {
+		return _current.load(std::memory_order_acquire);
+	}
+
+private:
+	/**
+	 * What the renewal timer and a renewal under way hold on to, either can still be running when the manager is destroyed.
+	 * Held shared while using the manager, the destructor takes it to detach the manager.
+	 */
+	struct self_handle {
+		std::shared_mutex mutex;
+		token_manager* manager = nullptr;
+	};
+
+	/* Takes copies, the request can outlive the manager */
+	static dpp::coroutine<client_credentials> _request_access(dpp::cluster &cluster, api_credentials credentials, std::string oauth_url);
+	void _publish(const client_credentials &credentials, app_timestamp requested_at);
+	void _schedule_refresh(app_duration delay);
+	static dpp::job _refresh(std::shared_ptr<self_handle> self, dpp::cluster &cluster, api_credentials credentials, std::string oauth_url);
+
+	dpp::cluster& _cluster;
+	timer_wheel& _timers;
+	api_credentials _credentials;
+	std::string _oauth_url;
+	std::atomic<std::shared_ptr<const access_token>> _current;
+	std::atomic<timer_wheel::timer_id> _refresh_timer = 0;
+	std::shared_ptr<self_handle> _self = std::make_shared<self_handle>();
+};
+
+}
+
+#endif /* MIMIRON_WOW_API_TOKEN_MANAGER_H_ */
@@ -1,10 +1,17 @@
 #ifndef MIMIRON_WOW_API_WOW_API_H_
 #define MIMIRON_WOW_API_WOW_API_H_
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
 
 #include "common.h"
 #include "tools/string_literal.h"
+#include "wow/api/localized_string.h"
 
 namespace mimiron::wow {
 
@@ -30,6 +37,8 @@ struct resource_location {
 	std::string     host;
 	string_literal<2> region_code;
 	game_version    version;
+	/* When set, only this locale is fetched and localized strings come as single strings */
+	std::optional<locale> language = std::nullopt;
 };
 
 struct api_region {
@@ -67,6 +76,99 @@ struct api_regions {
 	static constexpr api_region const& china = all[4];
 };
 
+namespace detail {
+
+constexpr fixed_string<32> make_namespace(string_literal<2> region_code, game_version version, api_namespace n) noexcept {
+	fixed_string<32> ret;
+	fixed_string<32>::iterator_t it = ret.begin();
+
+	switch (n) {
+		case api_static:
+			it = std::copy_n("static", 6, it);
+			break;
+
+		case api_dynamic:
+			it = std::copy_n("dynamic", 7, it);
+			break;
+
+		case api_profile:
+			it = std::copy_n("profile", 7, it);
+			break;
+	}
+
+	switch (version) {
+		case retail:
+			break;
+
+		case progression:
+			it = std::copy_n("-classic", 8, it);
+			break;
+
+		case classic_era:
+			it = std::copy_n("-classic1x", 10, it);
+			break;
+	}
+	*it = '-';
+	++it;
+	*it = region_code[0];
+	++it;
+	*it = region_code[1];
+	++it;
+	ret.str_size = std::distance(ret.begin(), it);
+	std::fill(it, ret.str.end(), 0);
+	return {ret};
+}
+
+inline constexpr size_t api_namespace_count = 3;
+inline constexpr size_t game_version_count = 3;
+
+/* Every namespace of every region, by api_namespace, then game version, then region */
+inline constexpr auto namespace_table = [] {
+	std::array<fixed_string<32>, api_namespace_count * game_version_count * api_regions::all.size()> table{};
+	auto it = table.begin();
+
+	for (size_t n = 0; n < api_namespace_count; ++n) {
+		for (size_t version = 0; version < game_version_count; ++version) {
+			for (const api_region& region : api_regions::all) {
+				*it = make_namespace(region.code, static_cast<game_version>(version), static_cast<api_namespace>(n));
+				++it;
+			}
+		}
+	}
+	return table;
+}();
+
+}
+
+/**
+ * Position of the region in api_regions::all, its size if no region has this code.
+ */
+constexpr size_t region_index(string_literal<2> code) noexcept {
+	size_t i = 0;
+
+	while (i < api_regions::all.size() && (api_regions::all[i].code[0] != code[0] || api_regions::all[i].code[1] != code[1])) {
+		++i;
+	}
+	return i;
+}
+
+/**
+ * Battle.net namespace of a resource, like "dynamic-classic-eu".
+ *
+ * @param region Position in api_regions::all
+ */
+constexpr std::string_view namespace_of(size_t region, game_version version, api_namespace n) noexcept {
+	assert(region < api_regions::all.size());
+	return detail::namespace_table[(std::to_underlying(n) * detail::game_version_count + std::to_underlying(version)) * api_regions::all.size() + region];
+}
+
+/**
+ * The location must be in one of api_regions.
+ */
+constexpr std::string_view namespace_of(const resource_location& location, api_namespace n) noexcept {
+	return namespace_of(region_index(location.region_code), location.version, n);
+}
+
 struct client_credentials {
 	std::string access_token;
 	std::string token_type;
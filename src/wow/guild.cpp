@@ -13,6 +13,8 @@ guild::guild(dpp::snowflake snowflake, uint8_t wow_id, std::string name)
 
 auto guild::name() const noexcept -> const std::string & { return (_name); }
 
+void guild::set_name(std::string name) { _name = std::move(name); }
+
 void guild::add_player(const character &chr) { return (add_player(chr.name)); }
 
 void guild::add_player(std::string_view player_name) {
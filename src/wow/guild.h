@@ -17,6 +17,7 @@ public:
 	guild(dpp::snowflake snowflake, uint8_t wow_id, std::string name);
 
 	const std::string &name() const noexcept;
+	void set_name(std::string name);
 	std::span<std::string const> members() const noexcept;
 	uint8_t wow_id() const noexcept;
 	dpp::snowflake discord_guild() const noexcept;
@@ -0,0 +1,109 @@
+#include "tools/backpressure.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <dpp/coro/job.h>
+
+#include "test.h"
+#include "tools/thread_pool.h"
+
+using namespace mimiron;
+using namespace std::chrono_literals;
+
+namespace {
+
+struct outcome {
+	enum state_t {
+		pending,
+		admitted,
+		refused
+	};
+
+	std::atomic<state_t> state = pending;
+	std::thread::id thread;
+};
+
+/* Takes the slot of an idle gate without suspending */
+admission_gate::ticket take(admission_gate& gate) {
+	auto entering = gate.enter();
+
+	CHECK(entering.await_ready());
+	return entering.await_resume();
+}
+
+dpp::job enter(admission_gate& gate, priority level, tenant_id tenant, outcome& out) {
+	try {
+		{
+			auto ticket = co_await gate.enter(level, tenant);
+
+			out.thread = std::this_thread::get_id();
+		}
+		/* Only once the slot is given back */
+		out.state = outcome::admitted;
+	} catch (const overloaded_exception&) {
+		out.state = outcome::refused;
+	}
+}
+
+bool settled(const outcome& out) {
+	for (auto deadline = std::chrono::steady_clock::now() + 2s; std::chrono::steady_clock::now() < deadline;) {
+		if (out.state != outcome::pending) {
+			return true;
+		}
+		std::this_thread::sleep_for(1ms);
+	}
+	return false;
+}
+
+/* No waiting limit under the wait policy means waiters are never refused, and they are resumed on the pool */
+void test_unbounded_wait() {
+	thread_pool pool{2};
+	admission_gate gate{pool, 1, overflow_policy::wait, 0};
+	outcome first, second, third;
+
+	{
+		auto held = take(gate);
+
+		CHECK(gate.enter().await_ready() == false);
+		enter(gate, priority::normal, 1, first);
+		enter(gate, priority::normal, 2, second);
+		enter(gate, priority::normal, 1, third);
+		CHECK(first.state == outcome::pending);
+		CHECK(gate.usage().size() == 3);
+	}
+	CHECK(settled(first) && settled(second) && settled(third));
+	CHECK(first.state == outcome::admitted && second.state == outcome::admitted && third.state == outcome::admitted);
+	CHECK(first.thread != std::this_thread::get_id());
+	CHECK(gate.in_flight() == 0);
+	/* Nobody has anything in flight or waiting anymore */
+	CHECK(gate.usage().empty());
+}
+
+/* A full waiting room under the shed policy drops a lower priority waiter, which is resumed with overloaded_exception */
+void test_shed() {
+	thread_pool pool{2};
+	admission_gate gate{pool, 1, overflow_policy::shed, 1};
+	outcome background, interactive;
+
+	{
+		auto held = take(gate);
+
+		enter(gate, priority::background, 1, background);
+		enter(gate, priority::interactive, 2, interactive);
+		CHECK(settled(background));
+		CHECK(background.state == outcome::refused);
+		CHECK(interactive.state == outcome::pending);
+	}
+	CHECK(settled(interactive));
+	CHECK(interactive.state == outcome::admitted);
+	CHECK(gate.usage().empty());
+}
+
+}
+
+int main() {
+	test_unbounded_wait();
+	test_shed();
+}
@@ -0,0 +1,138 @@
+#include "tools/fair_queue.h"
+
+#include <cstdlib>
+#include <map>
+#include <utility>
+
+#include "test.h"
+
+using namespace mimiron;
+
+namespace {
+
+using item = std::pair<tenant_id, int>;
+
+/* Turns each tenant got in the next `count` pops */
+std::map<tenant_id, size_t> serve(fair_queue<item>& queue, size_t count) {
+	std::map<tenant_id, size_t> turns;
+
+	for (size_t i = 0; i < count; ++i) {
+		++turns[queue.pop().first];
+	}
+	return turns;
+}
+
+void fill(fair_queue<item>& queue, tenant_id tenant, int count, double weight = 1.0) {
+	for (int i = 0; i < count; ++i) {
+		queue.push(tenant, {tenant, i}, weight);
+	}
+}
+
+/* Backlogged tenants share the turns by weight, however much each has queued */
+void test_share_ratios() {
+	fair_queue<item> queue;
+
+	fill(queue, 1, 1000, 3.0);
+	fill(queue, 2, 200, 1.0);
+	fill(queue, 3, 400, 2.0);
+
+	auto turns = serve(queue, 600);
+
+	/* 3:1:2 of 600, give or take the turn of a round in progress */
+	CHECK(std::abs(static_cast<long>(turns[1]) - 300) <= 3);
+	CHECK(std::abs(static_cast<long>(turns[2]) - 100) <= 3);
+	CHECK(std::abs(static_cast<long>(turns[3]) - 200) <= 3);
+	CHECK(queue.size() == 1000);
+}
+
+void test_equal_weights_alternate() {
+	fair_queue<item> queue;
+
+	fill(queue, 1, 100);
+	fill(queue, 2, 3);
+
+	/* The heavy tenant doesn't get a second turn while the light one is waiting */
+	for (int i = 0; i < 3; ++i) {
+		CHECK(queue.pop().first == 1);
+		CHECK(queue.pop().first == 2);
+	}
+	CHECK(queue.queued(2) == 0);
+	CHECK(queue.pop().first == 1);
+}
+
+void test_order_within_tenant() {
+	fair_queue<item> queue;
+
+	fill(queue, 1, 50, 2.0);
+	fill(queue, 2, 50);
+
+	int next[3] = {0, 0, 0};
+
+	while (!queue.empty()) {
+		auto [tenant, i] = queue.pop();
+
+		CHECK(i == next[tenant]++);
+	}
+	CHECK(next[1] == 50 && next[2] == 50);
+}
+
+/* A tenant arriving with nothing queued gets its burst ahead of a busy one */
+void test_burst() {
+	fair_queue<item> queue{4};
+
+	fill(queue, 1, 100);
+	serve(queue, 10);
+	fill(queue, 2, 4);
+
+	auto turns = serve(queue, 5);
+
+	CHECK(turns[2] == 4);
+	CHECK(queue.queued(2) == 0);
+
+	/* Idle tenants are forgotten, coming back later is a new burst */
+	serve(queue, 10);
+	fill(queue, 2, 4);
+	CHECK(serve(queue, 5)[2] == 4);
+}
+
+/* The weight given with the first push holds until the tenant runs dry */
+void test_weight_fixed_while_queued() {
+	fair_queue<item> queue;
+
+	fill(queue, 1, 400, 1.0);
+	fill(queue, 2, 400, 1.0);
+	/* Ignored, tenant 2 already has items queued */
+	queue.push(2, {2, 400}, 10.0);
+
+	auto turns = serve(queue, 200);
+
+	CHECK(std::abs(static_cast<long>(turns[1]) - static_cast<long>(turns[2])) <= 1);
+}
+
+void test_pop_heaviest() {
+	fair_queue<item> queue;
+
+	CHECK(!queue.pop_heaviest().has_value());
+
+	fill(queue, 1, 3);
+	fill(queue, 2, 5);
+
+	auto shed = queue.pop_heaviest(4);
+
+	/* The newest item of the tenant with the most queued */
+	CHECK(shed.has_value() && shed->first == 2 && shed->second == 4);
+	CHECK(queue.queued(2) == 4);
+	CHECK(!queue.pop_heaviest(4).has_value());
+	CHECK(queue.size() == 7);
+}
+
+}
+
+int main() {
+	test_share_ratios();
+	test_equal_weights_alternate();
+	test_order_within_tenant();
+	test_burst();
+	test_weight_fixed_while_queued();
+	test_pop_heaviest();
+}
@@ -0,0 +1,182 @@
+#include "tools/json_stream.h"
+
+#include <algorithm>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "test.h"
+#include "tools/parse_json.h"
+#include "wow/api/realm.h"
+
+using namespace mimiron;
+
+namespace {
+
+/* Shortened from /data/wow/realm/tichondrius, in every locale */
+constexpr std::string_view realm_fixture = R"({
+	"_links": {"self": {"href": "https://us.api.blizzard.com/data/wow/realm/tichondrius?namespace=dynamic-us"}},
+	"id": 11,
+	"region": {
+		"key": {"href": "https://us.api.blizzard.com/data/wow/region/1?namespace=dynamic-us"},
+		"name": {"en_US": "North America", "es_MX": "Norteamérica", "pt_BR": "América do Norte", "de_DE": "Nordamerika", "en_GB": "North America", "es_ES": "Norteamérica", "fr_FR": "Amérique du Nord", "it_IT": "Nord America", "ru_RU": "Северная Америка", "ko_KR": "미국", "zh_TW": "北美"},
+		"id": 1
+	},
+	"connected_realm": {"href": "https://us.api.blizzard.com/data/wow/connected-realm/11?namespace=dynamic-us"},
+	"name": {"en_US": "Tichondrius", "es_MX": "Tichondrius", "pt_BR": "Tichondrius", "de_DE": "Tichondrius", "en_GB": "Tichondrius", "es_ES": "Tichondrius", "fr_FR": "Tichondrius", "it_IT": "Tichondrius", "ru_RU": "Тихондриус", "ko_KR": "티콘드리우스", "zh_TW": "提克迪奧斯"},
+	"category": {"en_US": "United States", "es_MX": "Estados Unidos", "de_DE": "Vereinigte Staaten", "fr_FR": "États-Unis"},
+	"locale": "enUS",
+	"timezone": "America/Los_Angeles",
+	"type": {"type": "PVP", "name": {"en_US": "PvP", "es_MX": "JcJ", "de_DE": "PvP", "fr_FR": "JcJ"}},
+	"is_tournament": false,
+	"slug": "tichondrius"
+})";
+
+/* Shortened from /data/wow/realm/index, fetched for en_US only */
+constexpr std::string_view realm_index_fixture = R"({
+	"_links": {"self": {"href": "https://eu.api.blizzard.com/data/wow/realm/index?namespace=dynamic-eu"}},
+	"realms": [
+		{"key": {"href": "https://eu.api.blizzard.com/data/wow/realm/1080?namespace=dynamic-eu"}, "name": "Khaz Modan", "id": 1080, "slug": "khaz-modan"},
+		{"key": {"href": "https://eu.api.blizzard.com/data/wow/realm/1390?namespace=dynamic-eu"}, "name": "GM Test realm 2", "id": 1390, "slug": "gm-test-realm-2"},
+		{"key": {"href": "https://eu.api.blizzard.com/data/wow/realm/1323?namespace=dynamic-eu"}, "name": "Anachronos", "id": 1323, "slug": "anachronos"}
+	]
+})";
+
+struct counts {
+	int64_t id;
+	double ratio;
+	bool enabled;
+	std::optional<int64_t> limit;
+};
+
+template <typename T>
+T from_dom(std::string_view json, const char* field = nullptr) {
+	nlohmann::json j = nlohmann::json::parse(json);
+
+	return parse_json<T>(field == nullptr ? j : j.at(field));
+}
+
+template <typename T>
+T from_stream(std::string_view json, const char* field = nullptr) {
+	return parse_json_stream<T>(std::as_bytes(std::span{json}), field);
+}
+
+template <typename Fn>
+bool throws(Fn&& fn) {
+	try {
+		fn();
+	} catch (const std::exception&) {
+		return true;
+	}
+	return false;
+}
+
+/* Member by member, the types compared have no operator== */
+template <typename T>
+bool same(const T& lhs, const T& rhs) {
+	if constexpr (std::is_same_v<T, wow::localized_string>) {
+		return lhs.buffer == rhs.buffer && lhs.ends == rhs.ends;
+	} else if constexpr (is_specialization_v<T, std::vector>) {
+		return std::ranges::equal(lhs, rhs, [](const auto& l, const auto& r) { return same(l, r); });
+	} else if constexpr (std::is_aggregate_v<T>) {
+		return [&]<size_t... Ns>(std::index_sequence<Ns...>) {
+			return (same(boost::pfr::get<Ns>(lhs), boost::pfr::get<Ns>(rhs)) && ...);
+		}(std::make_index_sequence<boost::pfr::tuple_size_v<T>>{});
+	} else {
+		return lhs == rhs;
+	}
+}
+
+void test_realm_fixture() {
+	auto streamed = from_stream<wow::realm>(realm_fixture);
+
+	CHECK(same(streamed, from_dom<wow::realm>(realm_fixture)));
+	CHECK(streamed.id == 11 && streamed.region.id == 1 && !streamed.is_tournament);
+	CHECK(streamed.name[wow::locale::ru_ru] == "Тихондриус");
+	CHECK(streamed.type.type == "PVP");
+}
+
+void test_realm_index_fixture() {
+	auto streamed = from_stream<std::vector<wow::realm_entry>>(realm_index_fixture, "realms");
+
+	CHECK(same(streamed, from_dom<std::vector<wow::realm_entry>>(realm_index_fixture, "realms")));
+	CHECK(streamed.size() == 3);
+	CHECK(streamed[1].id == 1390 && streamed[1].slug == "gm-test-realm-2");
+	/* Single strings stand for every locale */
+	CHECK(streamed[2].name[wow::locale::fr_fr] == "Anachronos");
+}
+
+void test_missing_field() {
+	constexpr std::string_view no_slug = R"({"key": {"href": "x"}, "name": "Khaz Modan", "id": 1080})";
+
+	CHECK(throws([&] { from_stream<wow::realm_entry>(no_slug); }));
+	CHECK(throws([&] { from_dom<wow::realm_entry>(no_slug); }));
+
+	/* Missing in a nested object too */
+	constexpr std::string_view no_region_id = R"({"key": {"href": "x"}, "name": "North America"})";
+
+	CHECK(throws([&] { from_stream<wow::realm::region_t>(no_region_id); }));
+	CHECK(throws([&] { from_dom<wow::realm::region_t>(no_region_id); }));
+
+	/* Optional members can be left out */
+	auto streamed = from_stream<counts>(R"({"id": 1, "ratio": 0.5, "enabled": true})");
+
+	CHECK(same(streamed, from_dom<counts>(R"({"id": 1, "ratio": 0.5, "enabled": true})")));
+	CHECK(!streamed.limit.has_value());
+}
+
+void test_numbers_in_strings() {
+	constexpr std::string_view quoted = R"({"id": "42", "ratio": "0.25", "enabled": "true", "limit": 7})";
+	auto streamed = from_stream<counts>(quoted);
+
+	CHECK(same(streamed, from_dom<counts>(quoted)));
+	CHECK(streamed.id == 42 && streamed.ratio == 0.25 && streamed.enabled && streamed.limit == 7);
+
+	/* Trailing garbage is not a number */
+	for (std::string_view bad : {R"({"id": "12abc", "ratio": 1, "enabled": true})", R"({"id": 1, "ratio": "0.5x", "enabled": true})", R"({"id": "", "ratio": 1, "enabled": true})"}) {
+		CHECK(throws([&] { from_stream<counts>(bad); }));
+		CHECK(throws([&] { from_dom<counts>(bad); }));
+	}
+}
+
+void test_skipped_subtrees() {
+	constexpr std::string_view nested = R"({
+		"_links": {"self": [{"href": {"deeper": [1, [2, {"deepest": null}], {}]}}, []]},
+		"id": 7,
+		"extra": [[], [{}], [[["id", 99]]]],
+		"ratio": 1.5,
+		"more": {"id": 99, "enabled": false},
+		"enabled": true
+	})";
+	auto streamed = from_stream<counts>(nested);
+
+	CHECK(same(streamed, from_dom<counts>(nested)));
+	/* Members of the same name in skipped subtrees don't leak into the object */
+	CHECK(streamed.id == 7 && streamed.enabled);
+}
+
+void test_output_field() {
+	/* The other members are skipped, before and after the one parsed */
+	constexpr std::string_view wrapped = R"({"before": {"realms": 1}, "realms": [{"key": {"href": "x"}, "name": "Khaz Modan", "id": 1080, "slug": "khaz-modan"}], "after": [1, 2]})";
+	auto streamed = from_stream<std::vector<wow::realm_entry>>(wrapped, "realms");
+
+	CHECK(same(streamed, from_dom<std::vector<wow::realm_entry>>(wrapped, "realms")));
+	CHECK(streamed.size() == 1 && streamed[0].id == 1080);
+
+	CHECK(throws([&] { from_stream<std::vector<wow::realm_entry>>(R"({"entries": []})", "realms"); }));
+	CHECK(throws([&] { from_dom<std::vector<wow::realm_entry>>(R"({"entries": []})", "realms"); }));
+	CHECK(throws([&] { from_stream<std::vector<wow::realm_entry>>(R"([])", "realms"); }));
+}
+
+}
+
+int main() {
+	test_realm_fixture();
+	test_realm_index_fixture();
+	test_missing_field();
+	test_numbers_in_strings();
+	test_skipped_subtrees();
+	test_output_field();
+}
@@ -0,0 +1,132 @@
+#include "tools/rate_limiter.h"
+
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <dpp/coro/job.h>
+
+#include "test.h"
+
+using namespace mimiron;
+
+namespace {
+
+struct waiters {
+	std::mutex mutex;
+	std::vector<int> order;
+	std::atomic<int> done = 0;
+	std::atomic<int> failed = 0;
+	std::thread::id thread;
+};
+
+dpp::job acquire(rate_limiter& limiter, int index, waiters& w) {
+	try {
+		co_await limiter.acquire();
+
+		std::unique_lock lock{w.mutex};
+
+		w.order.push_back(index);
+		w.thread = std::this_thread::get_id();
+	} catch (const exception&) {
+		++w.failed;
+	}
+	++w.done;
+}
+
+bool all_done(const waiters& w, int count) {
+	for (auto deadline = app_clock::now() + 3s; app_clock::now() < deadline;) {
+		if (w.done == count) {
+			return true;
+		}
+		std::this_thread::sleep_for(5ms);
+	}
+	return false;
+}
+
+/* A full bucket allows a burst of its size, then refills continuously at its rate */
+void test_refill() {
+	thread_pool pool{2};
+	timer_wheel wheel{pool};
+	/* 10 tokens per second */
+	rate_limiter limiter{wheel, {{5, 500ms}}};
+
+	for (int i = 0; i < 5; ++i) {
+		CHECK(limiter.try_acquire());
+	}
+	CHECK(!limiter.try_acquire());
+	std::this_thread::sleep_for(150ms);
+	CHECK(limiter.try_acquire());
+	CHECK(!limiter.try_acquire());
+}
+
+/* The tightest bucket decides, and waiters are woken by the timer as tokens come back, in order */
+void test_waiters() {
+	thread_pool pool{2};
+	timer_wheel wheel{pool};
+	rate_limiter limiter{wheel, {{100, 1s}, {2, 200ms}}};
+	waiters w;
+
+	CHECK(limiter.try_acquire());
+	CHECK(limiter.try_acquire());
+
+	auto start = app_clock::now();
+
+	for (int i = 0; i < 4; ++i) {
+		acquire(limiter, i, w);
+	}
+	CHECK(w.done == 0);
+	CHECK(limiter.headroom() < 0.0);
+	CHECK(all_done(w, 4));
+	/* 4 tokens at 10 per second */
+	CHECK(app_clock::now() - start >= 350ms);
+	CHECK((w.order == std::vector<int>{0, 1, 2, 3}));
+	CHECK(w.thread != std::this_thread::get_id());
+	CHECK(w.failed == 0);
+}
+
+/* Throttling empties the buckets and hands out nothing until the delay has passed */
+void test_throttle() {
+	thread_pool pool{2};
+	timer_wheel wheel{pool};
+	rate_limiter limiter{wheel, {{5, 500ms}}};
+
+	limiter.throttle(300ms);
+	CHECK(limiter.headroom() == std::numeric_limits<double>::lowest());
+	std::this_thread::sleep_for(200ms);
+	CHECK(!limiter.try_acquire());
+	/* Refilling only starts once the delay is over */
+	std::this_thread::sleep_for(150ms);
+	CHECK(!limiter.try_acquire());
+	std::this_thread::sleep_for(100ms);
+	CHECK(limiter.try_acquire());
+}
+
+/* Coroutines still waiting when the limiter goes away are resumed with an exception rather than leaked */
+void test_destroyed_with_waiters() {
+	thread_pool pool{2};
+	timer_wheel wheel{pool};
+	auto limiter = std::make_unique<rate_limiter>(wheel, std::initializer_list<rate_limiter::limit>{{1, 1h}});
+	waiters w;
+
+	CHECK(limiter->try_acquire());
+	acquire(*limiter, 0, w);
+	acquire(*limiter, 1, w);
+	limiter.reset();
+	CHECK(all_done(w, 2));
+	CHECK(w.failed == 2);
+	CHECK(w.order.empty());
+}
+
+}
+
+int main() {
+	test_refill();
+	test_waiters();
+	test_throttle();
+	test_destroyed_with_waiters();
+}
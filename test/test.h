@@ -0,0 +1,16 @@
+#ifndef MIMIRON_TEST_TEST_H_
+#define MIMIRON_TEST_TEST_H_
+
+#include <cstdio>
+#include <cstdlib>
+
+/* Like assert, but also checked in release builds and reports where it failed */
+#define CHECK(...) \
+	do { \
+		if (!(__VA_ARGS__)) { \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #__VA_ARGS__); \
+			std::exit(EXIT_FAILURE); \
+		} \
+	} while (false)
+
+#endif /* MIMIRON_TEST_TEST_H_ */
@@ -0,0 +1,77 @@
+#include "tools/thread_pool.h"
+
+#include <atomic>
+#include <latch>
+#include <stdexcept>
+#include <vector>
+
+#include "test.h"
+
+using namespace mimiron;
+
+namespace {
+
+void test_schedule() {
+	thread_pool pool{2};
+
+	CHECK(pool.schedule([] { return 42; }).sync_wait() == 42);
+
+	bool thrown = false;
+
+	try {
+		pool.schedule([]() -> int { throw std::runtime_error{"failed"}; }).sync_wait();
+	} catch (const std::runtime_error&) {
+		thrown = true;
+	}
+	CHECK(thrown);
+}
+
+/* Work queued behind busy threads when the pool is stopped still runs, including work it queues itself */
+void test_stop_drains() {
+	constexpr int tasks = 1000;
+	constexpr int results = 16;
+
+	thread_pool pool{2};
+	std::latch busy{2};
+	std::atomic<bool> release = false;
+	std::atomic<int> ran = 0;
+	std::vector<dpp::awaitable<int>> scheduled;
+
+	for (int i = 0; i < 2; ++i) {
+		pool.queue([&]() noexcept {
+			busy.count_down();
+			release.wait(false);
+		});
+	}
+	busy.wait();
+	for (int i = 0; i < tasks; ++i) {
+		pool.queue([&]() noexcept {
+			++ran;
+		});
+	}
+	pool.queue([&]() noexcept {
+		pool.queue([&]() noexcept {
+			++ran;
+		});
+	});
+	for (int i = 0; i < results; ++i) {
+		scheduled.push_back(pool.schedule([i] { return i; }));
+	}
+
+	auto stopped = pool.stop();
+
+	release = true;
+	release.notify_all();
+	stopped.sync_wait();
+	CHECK(ran == tasks + 1);
+	for (int i = 0; i < results; ++i) {
+		CHECK(scheduled[i].sync_wait() == i);
+	}
+}
+
+}
+
+int main() {
+	test_schedule();
+	test_stop_drains();
+}
@@ -0,0 +1,145 @@
+#include "tools/timer_wheel.h"
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <latch>
+#include <thread>
+
+#include <dpp/coro/job.h>
+
+#include "test.h"
+
+using namespace mimiron;
+
+namespace {
+
+/* Started eagerly and left suspended at the end, so that the test can destroy it while it sleeps */
+struct detached {
+	struct promise_type {
+		detached get_return_object() noexcept {
+			return {std::coroutine_handle<promise_type>::from_promise(*this)};
+		}
+
+		std::suspend_never initial_suspend() const noexcept {
+			return {};
+		}
+
+		std::suspend_always final_suspend() const noexcept {
+			return {};
+		}
+
+		void return_void() const noexcept {}
+
+		void unhandled_exception() const noexcept {
+			std::terminate();
+		}
+	};
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+detached sleep_then_set(timer_wheel& wheel, app_duration delay, std::atomic<bool>& woke) {
+	co_await wheel.sleep_for(delay);
+	woke = true;
+}
+
+dpp::job sleep_then_count_down(timer_wheel& wheel, app_duration delay, app_timestamp& woke_at, std::latch& done) {
+	co_await wheel.sleep_for(delay);
+	woke_at = app_clock::now();
+	done.count_down();
+}
+
+void test_sleep_for() {
+	thread_pool pool{2};
+	timer_wheel wheel{pool};
+	app_timestamp start = app_clock::now();
+	app_timestamp woke_at;
+	std::latch done{1};
+
+	sleep_then_count_down(wheel, 250ms, woke_at, done);
+	done.wait();
+	CHECK(woke_at - start >= 250ms);
+}
+
+/* 70 ticks is past the first level, the timer only fires once it has been cascaded down */
+void test_cascade() {
+	thread_pool pool{2};
+	timer_wheel wheel{pool};
+	constexpr app_duration delay = timer_wheel::tick * 70;
+	app_timestamp deadline = app_clock::now() + delay;
+	app_timestamp fired_at;
+	std::latch fired{1};
+
+	wheel.schedule_at(deadline, [&] {
+		fired_at = app_clock::now();
+		fired.count_down();
+	});
+	CHECK(fired.try_wait() == false);
+	fired.wait();
+	CHECK(fired_at >= deadline);
+	CHECK(fired_at - deadline < timer_wheel::tick * 5);
+}
+
+void test_cancel() {
+	thread_pool pool{2};
+	timer_wheel wheel{pool};
+	std::atomic<int> fired = 0;
+
+	auto soon = wheel.schedule_after(300ms, [&] { ++fired; });
+	/* Sits in the second level */
+	auto later = wheel.schedule_after(timer_wheel::tick * 100, [&] { ++fired; });
+	auto kept = wheel.schedule_after(200ms, [&] { ++fired; });
+
+	CHECK(wheel.cancel(soon));
+	CHECK(wheel.cancel(later));
+	CHECK(!wheel.cancel(later));
+	std::this_thread::sleep_for(600ms);
+	CHECK(fired == 1);
+	/* Already fired */
+	CHECK(!wheel.cancel(kept));
+}
+
+void test_every() {
+	thread_pool pool{2};
+	timer_wheel wheel{pool};
+	std::atomic<int> runs = 0;
+
+	auto id = wheel.every(200ms, [&] { ++runs; }, 50ms);
+
+	std::this_thread::sleep_for(1100ms);
+	CHECK(wheel.cancel(id));
+	/* A run that expired just before can still be on its way through the pool */
+	std::this_thread::sleep_for(50ms);
+
+	int seen = runs;
+
+	CHECK(seen >= 4 && seen <= 5);
+	std::this_thread::sleep_for(400ms);
+	CHECK(runs == seen);
+}
+
+/* Destroying a sleeping coroutine takes its timer off the wheel instead of leaving it to resume a dead frame */
+void test_destroyed_sleeper() {
+	thread_pool pool{2};
+	timer_wheel wheel{pool};
+	std::atomic<bool> woke = false;
+	std::latch after{1};
+
+	detached sleeping = sleep_then_set(wheel, 300ms, woke);
+
+	sleeping.handle.destroy();
+	wheel.schedule_after(500ms, [&] { after.count_down(); });
+	after.wait();
+	CHECK(!woke);
+}
+
+}
+
+int main() {
+	test_sleep_for();
+	test_cascade();
+	test_cancel();
+	test_every();
+	test_destroyed_sleeper();
+}
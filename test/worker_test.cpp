@@ -0,0 +1,77 @@
+#include "tools/worker.h"
+
+#include <array>
+#include <latch>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <dpp/coro/job.h>
+
+#include "test.h"
+
+using namespace mimiron;
+
+namespace {
+
+/* Producers racing on the queue each see their own submissions run in order, and none are lost */
+void test_producer_order() {
+	constexpr size_t producers = 4;
+	constexpr int per_producer = 20000;
+
+	worker w;
+	/* Only touched on the worker thread */
+	std::vector<std::pair<size_t, int>> seen;
+	std::latch start{producers};
+
+	seen.reserve(producers * per_producer);
+	{
+		std::vector<std::jthread> threads;
+
+		for (size_t p = 0; p < producers; ++p) {
+			threads.emplace_back([&, p] {
+				start.arrive_and_wait();
+				for (int i = 0; i < per_producer; ++i) {
+					w.queue([&seen, p, i]() noexcept {
+						seen.emplace_back(p, i);
+					});
+				}
+			});
+		}
+	}
+	/* Runs after everything queued before it */
+	w.schedule([] {}).sync_wait();
+	CHECK(seen.size() == producers * per_producer);
+
+	std::array<int, producers> next{};
+
+	for (auto [p, i] : seen) {
+		CHECK(i == next[p]);
+		++next[p];
+	}
+	CHECK(w.size() == 0);
+}
+
+dpp::job hop_to(worker& w, std::thread::id& resumed_on, std::latch& done) {
+	co_await w.schedule_on();
+	resumed_on = std::this_thread::get_id();
+	done.count_down();
+}
+
+void test_schedule_on() {
+	worker w;
+	std::thread::id worker_thread = w.schedule([] { return std::this_thread::get_id(); }).sync_wait();
+	std::thread::id resumed_on;
+	std::latch done{1};
+
+	hop_to(w, resumed_on, done);
+	done.wait();
+	CHECK(resumed_on == worker_thread);
+}
+
+}
+
+int main() {
+	test_producer_order();
+	test_schedule_on();
+}
@@ -0,0 +1,451 @@
+/**
+ * Stand-in for the Battle.net API, to run the bot and load-test it without spending the real quota.
+ *
+ * Serves the OAuth token endpoint and any GET from recorded fixtures, laid out as
+ * `<fixtures>/<Battlenet-Namespace>/<path>.json` like the bot records them with `wow_api_record_fixtures`.
+ * Latency, errors and 429s can be injected, and the number of answers per status is printed every second.
+ *
+ * Plain HTTP only; point the bot at it with `wow_api_base_url` and `wow_oauth_url`.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+namespace stdfs = std::filesystem;
+
+using namespace std::chrono_literals;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+struct options {
+	uint16_t port = 8080;
+	stdfs::path fixtures = "fixtures";
+	milliseconds latency{0};
+	milliseconds jitter{0};
+	double error_rate = 0;
+	double throttle_rate = 0;
+	/* Requests allowed per second before answering 429 like the real API, 0 for no limit */
+	size_t quota = 0;
+	int retry_after = 1;
+	int max_age = 300;
+	int token_lifetime = 86400;
+	uint32_t seed = 0;
+};
+
+struct request {
+	std::string method;
+	std::string path;
+	std::string query;
+	std::map<std::string, std::string> headers;
+};
+
+struct response {
+	int status = 200;
+	std::string body;
+	std::vector<std::pair<std::string, std::string>> headers;
+};
+
+class statistics {
+public:
+	void count(int status) {
+		std::scoped_lock lock{_mutex};
+
+		++_current[status];
+		++_total[status];
+	}
+
+	/* Prints and resets the counts of the last period, if anything happened */
+	void report() {
+		std::map<int, size_t> current;
+		{
+			std::scoped_lock lock{_mutex};
+
+			current = std::exchange(_current, {});
+		}
+		if (!current.empty()) {
+			std::cout << print("last second", current) << std::endl;
+		}
+	}
+
+	void summary() {
+		std::scoped_lock lock{_mutex};
+
+		std::cout << print("total", _total) << std::endl;
+	}
+
+private:
+	static std::string print(std::string_view label, const std::map<int, size_t> &counts) {
+		size_t sum = 0;
+		std::string ret;
+
+		for (auto [status, n] : counts) {
+			sum += n;
+			ret += " " + std::to_string(status) + ": " + std::to_string(n);
+		}
+		return std::string{label} + ": " + std::to_string(sum) + " requests," + ret;
+	}
+
+	std::mutex _mutex;
+	std::map<int, size_t> _current;
+	std::map<int, size_t> _total;
+};
+
+options settings;
+statistics stats;
+std::atomic<bool> stopping = false;
+int listen_fd = -1;
+
+std::string_view status_text(int status) {
+	switch (status) {
+		case 200: return "OK";
+		case 304: return "Not Modified";
+		case 400: return "Bad Request";
+		case 404: return "Not Found";
+		case 429: return "Too Many Requests";
+		default: return "Internal Server Error";
+	}
+}
+
+std::string lowercase(std::string str) {
+	for (char &c : str) {
+		c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	}
+	return str;
+}
+
+std::string error_body(int status) {
+	return "{\"code\":" + std::to_string(status) + ",\"type\":\"BLZWEBAPI00000" + std::to_string(status) + "\",\"detail\":\"" + std::string{status_text(status)} + "\"}";
+}
+
+/* FNV-1a, enough to tell fixtures apart for ETags */
+std::string etag_of(std::string_view data) {
+	uint64_t hash = 14695981039346656037ull;
+
+	for (char c : data) {
+		hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+	}
+	std::array<char, 19> buf;
+	std::snprintf(buf.data(), buf.size(), "\"%016llx\"", static_cast<unsigned long long>(hash));
+	return buf.data();
+}
+
+/**
+ * Same layout the bot records to: query strings are kept after an '@' so that variants don't overwrite each other.
+ */
+std::optional<stdfs::path> fixture_path(std::string_view ns, std::string_view path, std::string_view query) {
+	if (ns.empty() || ns.find("..") != std::string_view::npos || path.find("..") != std::string_view::npos) {
+		return std::nullopt;
+	}
+	/* The namespace comes from a header and names a single directory: appending an absolute path would replace the fixtures root */
+	if (ns.find_first_of("/\\:") != std::string_view::npos || stdfs::path{ns}.has_root_path()) {
+		return std::nullopt;
+	}
+	std::string file{path.substr(path.find_first_not_of('/') == std::string_view::npos ? path.size() : path.find_first_not_of('/'))};
+
+	if (!query.empty()) {
+		file += '@';
+		file += query;
+	}
+	return settings.fixtures / ns / (file + ".json");
+}
+
+response serve_token() {
+	return {
+		.body = "{\"access_token\":\"mock-token\",\"token_type\":\"bearer\",\"expires_in\":" + std::to_string(settings.token_lifetime) + "}",
+		.headers = {{"Content-Type", "application/json"}}
+	};
+}
+
+response serve_resource(const request &req) {
+	std::string ns;
+
+	if (auto it = req.headers.find("battlenet-namespace"); it != req.headers.end()) {
+		ns = it->second;
+	}
+	auto path = fixture_path(ns, req.path, req.query);
+	std::ifstream fs;
+
+	if (path) {
+		fs.open(*path, std::ios::in | std::ios::binary);
+	}
+	/* A stream never opened is still good() */
+	if (!fs.is_open() || !fs.good()) {
+		return {.status = 404, .body = error_body(404), .headers = {{"Content-Type", "application/json"}}};
+	}
+	std::stringstream body;
+	body << fs.rdbuf();
+
+	response res{.body = std::move(body).str()};
+	std::string etag = etag_of(res.body);
+
+	if (auto it = req.headers.find("if-none-match"); it != req.headers.end() && it->second == etag) {
+		res.status = 304;
+		res.body.clear();
+	}
+	res.headers = {
+		{"Content-Type", "application/json"},
+		{"Cache-Control", "max-age=" + std::to_string(settings.max_age)},
+		{"ETag", std::move(etag)}
+	};
+	return res;
+}
+
+class injector {
+public:
+	/* Decides whether this request fails on purpose, and waits the simulated latency */
+	std::optional<response> operator()() {
+		bool throttled = false;
+		bool failed = false;
+		milliseconds delay = settings.latency;
+		{
+			std::scoped_lock lock{_mutex};
+			auto second = std::chrono::floor<std::chrono::seconds>(steady_clock::now());
+
+			if (second != _second) {
+				_second = second;
+				_in_second = 0;
+			}
+			throttled = (settings.quota > 0 && ++_in_second > settings.quota) || _chance(_engine) < settings.throttle_rate;
+			failed = !throttled && _chance(_engine) < settings.error_rate;
+			if (settings.jitter.count() > 0) {
+				delay += milliseconds{std::uniform_int_distribution<int64_t>{0, settings.jitter.count()}(_engine)};
+			}
+		}
+		std::this_thread::sleep_for(delay);
+		if (throttled) {
+			return response{
+				.status = 429,
+				.body = error_body(429),
+				.headers = {{"Content-Type", "application/json"}, {"Retry-After", std::to_string(settings.retry_after)}}
+			};
+		}
+		if (failed) {
+			return response{.status = 500, .body = error_body(500), .headers = {{"Content-Type", "application/json"}}};
+		}
+		return std::nullopt;
+	}
+
+private:
+	std::mutex _mutex;
+	std::mt19937 _engine{settings.seed};
+	std::uniform_real_distribution<double> _chance{0.0, 1.0};
+	std::chrono::time_point<steady_clock, std::chrono::seconds> _second{};
+	size_t _in_second = 0;
+};
+
+injector inject;
+
+response handle(const request &req) {
+	if (auto failure = inject(); failure) {
+		return *std::move(failure);
+	}
+	if (req.method == "POST" && (req.path == "/token" || req.path == "/oauth/token")) {
+		return serve_token();
+	}
+	if (req.method != "GET") {
+		return {.status = 400, .body = error_body(400), .headers = {{"Content-Type", "application/json"}}};
+	}
+	return serve_resource(req);
+}
+
+bool send_all(int fd, std::string_view data) {
+	while (!data.empty()) {
+		ssize_t sent = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+
+		if (sent <= 0) {
+			return false;
+		}
+		data.remove_prefix(static_cast<size_t>(sent));
+	}
+	return true;
+}
+
+/* Reads one request off the connection, buffer keeps whatever was read past it */
+std::optional<request> read_request(int fd, std::string &buffer) {
+	size_t head_end;
+
+	while ((head_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+		std::array<char, 4096> chunk;
+		ssize_t n = ::recv(fd, chunk.data(), chunk.size(), 0);
+
+		if (n <= 0 || buffer.size() > 65536) {
+			return std::nullopt;
+		}
+		buffer.append(chunk.data(), static_cast<size_t>(n));
+	}
+
+	request req;
+	std::istringstream head{buffer.substr(0, head_end)};
+	std::string line;
+	std::string target;
+
+	std::getline(head, line);
+	std::istringstream{line} >> req.method >> target;
+	while (std::getline(head, line)) {
+		if (auto colon = line.find(':'); colon != std::string::npos) {
+			auto value = line.substr(line.find_first_not_of(' ', colon + 1));
+
+			if (!value.empty() && value.back() == '\r') {
+				value.pop_back();
+			}
+			req.headers[lowercase(line.substr(0, colon))] = std::move(value);
+		}
+	}
+	if (auto q = target.find('?'); q != std::string::npos) {
+		req.query = target.substr(q + 1);
+		target.resize(q);
+	}
+	req.path = std::move(target);
+
+	size_t content_length = 0;
+	if (auto it = req.headers.find("content-length"); it != req.headers.end()) {
+		content_length = std::strtoull(it->second.c_str(), nullptr, 10);
+	}
+	buffer.erase(0, head_end + 4);
+	while (buffer.size() < content_length) {
+		std::array<char, 4096> chunk;
+		ssize_t n = ::recv(fd, chunk.data(), chunk.size(), 0);
+
+		if (n <= 0) {
+			return std::nullopt;
+		}
+		buffer.append(chunk.data(), static_cast<size_t>(n));
+	}
+	buffer.erase(0, content_length);
+	return req;
+}
+
+void serve_connection(int fd) {
+	std::string buffer;
+
+	while (auto req = read_request(fd, buffer)) {
+		response res = handle(*req);
+		bool keep_alive = lowercase(req->headers["connection"]) != "close";
+		std::string out = "HTTP/1.1 " + std::to_string(res.status) + " " + std::string{status_text(res.status)} + "\r\n";
+
+		for (const auto &[key, value] : res.headers) {
+			out += key + ": " + value + "\r\n";
+		}
+		out += "Content-Length: " + std::to_string(res.body.size()) + "\r\n";
+		out += keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+		out += res.body;
+		stats.count(res.status);
+		if (!send_all(fd, out) || !keep_alive) {
+			break;
+		}
+	}
+	::close(fd);
+}
+
+void usage(const char *name) {
+	std::cerr << "usage: " << name << " [--port N] [--fixtures DIR] [--latency MS] [--jitter MS] [--error-rate P]\n"
+		"    [--throttle-rate P] [--quota N] [--retry-after S] [--max-age S] [--token-lifetime S] [--seed N]\n";
+}
+
+bool parse_options(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		std::string_view arg = argv[i];
+
+		if (i + 1 >= argc) {
+			return false;
+		}
+		const char *value = argv[++i];
+
+		if (arg == "--port") {
+			settings.port = static_cast<uint16_t>(std::atoi(value));
+		} else if (arg == "--fixtures") {
+			settings.fixtures = value;
+		} else if (arg == "--latency") {
+			settings.latency = milliseconds{std::atoll(value)};
+		} else if (arg == "--jitter") {
+			settings.jitter = milliseconds{std::atoll(value)};
+		} else if (arg == "--error-rate") {
+			settings.error_rate = std::atof(value);
+		} else if (arg == "--throttle-rate") {
+			settings.throttle_rate = std::atof(value);
+		} else if (arg == "--quota") {
+			settings.quota = std::strtoull(value, nullptr, 10);
+		} else if (arg == "--retry-after") {
+			settings.retry_after = std::atoi(value);
+		} else if (arg == "--max-age") {
+			settings.max_age = std::atoi(value);
+		} else if (arg == "--token-lifetime") {
+			settings.token_lifetime = std::atoi(value);
+		} else if (arg == "--seed") {
+			settings.seed = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+}
+
+int main(int argc, char **argv) {
+	if (!parse_options(argc, argv)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(settings.port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(listen_fd, SOMAXCONN) != 0) {
+		std::perror("could not listen");
+		return 1;
+	}
+	std::signal(SIGINT, [](int) {
+		stopping = true;
+		::shutdown(listen_fd, SHUT_RDWR);
+	});
+	std::cout << "serving " << settings.fixtures.string() << " on http://127.0.0.1:" << settings.port << std::endl;
+
+	std::jthread reporter{[](std::stop_token stop) {
+		while (!stop.stop_requested()) {
+			std::this_thread::sleep_for(1s);
+			stats.report();
+		}
+	}};
+
+	while (!stopping) {
+		int fd = ::accept(listen_fd, nullptr, nullptr);
+
+		if (fd < 0) {
+			continue;
+		}
+		std::thread{serve_connection, fd}.detach();
+	}
+	::close(listen_fd);
+	stats.summary();
+	return 0;
+}